@@ -0,0 +1,176 @@
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+/* This program runs one benchmark workload against a running MMU and prints
+ * its results as a line of KEY=VALUE pairs.  PROCS processes each allocate
+ * PAGES pages and make ACCESSES accesses; they start together once all of
+ * them are set up.  Fault counts and latencies come from the MMU's
+ * statistics (see `uvm_stats`); its latency histograms are never reset, so
+ * the MMU should be started afresh for each run. */
+
+static const char *workloads[] = {"seqread", "seqwrite", "randread",
+		"randwrite", "contention", "syslog", NULL};
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s WORKLOAD PAGES ACCESSES PROCS\n", prog);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "workloads: seqread seqwrite randread randwrite\n");
+	fprintf(stderr, "           contention (writes and syslogs each page"
+			" in turn, as test12)\n");
+	fprintf(stderr, "           syslog (syslogs a page at a random offset)\n");
+	fprintf(stderr, "valid ranges: 1 <= PAGES <= 256, 1 <= PROCS <= 256\n");
+	exit(EXIT_FAILURE);
+}
+
+static uint64_t next_rand(uint64_t *state) {
+	/* xorshift64* */
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(int workload, int npages, long naccesses, int id, int start) {
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	uvm_create();
+	size_t count;
+	char *base = uvm_extend_batch(npages, &count);
+	if(!base || count != (size_t)npages) {
+		fprintf(stderr, "uvm_extend_batch: not enough blocks\n");
+		exit(EXIT_FAILURE);
+	}
+	char c;
+	/* the parent closes its end of the pipe to start all processes */
+	if(read(start, &c, 1) != 0) exit(EXIT_FAILURE);
+	close(start);
+
+	uint64_t rng = id + 1;
+	volatile char *mem = (volatile char *)base;
+	char buf[16];
+	for(long i = 0; i < naccesses; ++i) {
+		long page = i % npages;
+		size_t off = (i / npages * 64) % pagesz;
+		switch(workload) {
+		case 0: /* seqread */
+			(void)mem[page * pagesz + off];
+			break;
+		case 1: /* seqwrite */
+			mem[page * pagesz + off] = (char)i;
+			break;
+		case 2: /* randread */
+			(void)mem[next_rand(&rng) % (npages * pagesz)];
+			break;
+		case 3: /* randwrite */
+			mem[next_rand(&rng) % (npages * pagesz)] = (char)i;
+			break;
+		case 4: /* contention */
+			snprintf(buf, sizeof(buf), "%010d", (int)getpid());
+			memcpy(base + page * pagesz + 10, buf, 10);
+			uvm_syslog(base + page * pagesz + 10, 10);
+			break;
+		case 5: { /* syslog */
+			size_t at = next_rand(&rng) % ((npages - 1) * pagesz + 1);
+			if(npages > 1) uvm_syslog(base + at, pagesz);
+			else uvm_syslog(base, pagesz);
+			break;
+		}
+		}
+	}
+	exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char **argv) {
+	if(argc != 5) usage(argv[0]);
+	int workload = 0;
+	while(workloads[workload] && strcmp(workloads[workload], argv[1]))
+		workload++;
+	if(!workloads[workload]) usage(argv[0]);
+	int npages = atoi(argv[2]);
+	long naccesses = atol(argv[3]);
+	int nprocs = atoi(argv[4]);
+	if(npages < 1 || npages > 256 || naccesses < 0) usage(argv[0]);
+	if(nprocs < 1 || nprocs > 256) usage(argv[0]);
+
+	int start[2];
+	if(pipe(start)) {
+		perror("pipe");
+		exit(EXIT_FAILURE);
+	}
+	for(int i = 0; i < nprocs; ++i) {
+		pid_t pid = fork();
+		if(pid == -1) {
+			perror("fork");
+			exit(EXIT_FAILURE);
+		}
+		if(pid == 0) {
+			close(start[1]);
+			run(workload, npages, naccesses, i, start[0]);
+		}
+	}
+	close(start[0]);
+
+	/* the parent only reads the MMU's statistics */
+	uvm_create();
+	struct uvm_stats before;
+	struct uvm_stats after;
+	uvm_stats(&before);
+	double t0 = now();
+	close(start[1]);
+	int failed = 0;
+	for(int i = 0; i < nprocs; ++i) {
+		int status;
+		wait(&status);
+		if(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+			failed++;
+	}
+	double secs = now() - t0;
+	uvm_stats(&after);
+	if(failed) {
+		fprintf(stderr, "%d processes failed\n", failed);
+		exit(EXIT_FAILURE);
+	}
+
+	uint64_t delta[UVM_STATS_COUNTERS];
+	for(int i = 0; i < UVM_STATS_COUNTERS; ++i)
+		delta[i] = after.counters[i] - before.counters[i];
+	uint64_t faults = delta[UVM_STATS_FAULT_ZERO]
+			+ delta[UVM_STATS_FAULT_PROT] + delta[UVM_STATS_FAULT_SWAPIN];
+	struct rusage ru;
+	getrusage(RUSAGE_CHILDREN, &ru);
+	double cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+			+ ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+	long total = naccesses * nprocs;
+	printf("workload=%s pages=%d procs=%d accesses=%ld secs=%.3f "
+			"accesses_per_sec=%.0f faults=%llu faults_per_sec=%.0f "
+			"fault_p50_ns=%llu fault_p99_ns=%llu syslog_p50_ns=%llu "
+			"syslog_p99_ns=%llu evictions=%llu "
+			"writebacks=%llu client_cpu_s=%.3f\n",
+			workloads[workload], npages, nprocs, total, secs,
+			secs > 0 ? total / secs : 0, (unsigned long long)faults,
+			secs > 0 ? faults / secs : 0,
+			(unsigned long long)after.hists[UVM_STATS_SEGV].p50,
+			(unsigned long long)after.hists[UVM_STATS_SEGV].p99,
+			(unsigned long long)after.hists[UVM_STATS_SYSLOG].p50,
+			(unsigned long long)after.hists[UVM_STATS_SYSLOG].p99,
+			(unsigned long long)delta[UVM_STATS_EVICT],
+			(unsigned long long)delta[UVM_STATS_WRITEBACK], cpu);
+	exit(EXIT_SUCCESS);
+}
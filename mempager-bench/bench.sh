@@ -0,0 +1,70 @@
+#!/bin/bash
+set -u
+
+# Runs the benchmarks in mempager-bench/bench.spec (or only those named on
+# the command line), each against a freshly started MMU, and prints one line
+# of KEY=VALUE pairs per benchmark.  BENCH_FRAMES and BENCH_BLOCKS override
+# the number of frames and blocks in the spec.  With BENCH_BASELINE naming the
+# output of an earlier run, benchmarks whose faults_per_sec fell or whose
+# fault_p99_ns grew by more than BENCH_TOLERANCE percent (default 20) are
+# reported on stderr and the script exits with status 1.
+BENCHSPEC=mempager-bench/bench.spec
+BENCH_TOLERANCE=${BENCH_TOLERANCE:-20}
+
+make > /dev/null || exit 1
+
+status=0
+while read -r name workload pages accesses procs frames blocks ; do
+    case "$name" in
+        ''|\#*) continue ;;
+    esac
+    if [ $# -gt 0 ] && [[ " $* " != *" $name "* ]] ; then
+        continue
+    fi
+    frames=${BENCH_FRAMES:-$frames}
+    blocks=${BENCH_BLOCKS:-$blocks}
+    rm -rf mmu.sock mmu.pmem.img.* mmu.ready
+    mkfifo mmu.ready
+    MMU_READY_FD=3 ./bin/mmu $frames $blocks &> /dev/null 3> mmu.ready &
+    mmu=$!
+    read -r -t 10 ready < mmu.ready
+    rm -f mmu.ready
+    result=$(./bin/bench $workload $pages $accesses $procs < /dev/null)
+    rc=$?
+    cpu=$(awk -v hz=$(getconf CLK_TCK) '{printf "%.3f", ($14 + $15) / hz}' \
+            /proc/$mmu/stat)
+    kill -SIGINT $mmu
+    wait $mmu
+    rm -rf mmu.sock mmu.pmem.img.*
+    if [ $rc -ne 0 ] ; then
+        echo "$name failed" >&2
+        status=1
+        continue
+    fi
+    line="name=$name frames=$frames blocks=$blocks $result mmu_cpu_s=$cpu"
+    echo "$line"
+    if [ -z "${BENCH_BASELINE:-}" ] ; then
+        continue
+    fi
+    base=$(grep "^name=$name " "$BENCH_BASELINE")
+    if [ -z "$base" ] ; then
+        continue
+    fi
+    if ! printf '%s\n%s\n' "$base" "$line" | awk -v tol=$BENCH_TOLERANCE '
+            {
+                for(i = 1; i <= NF; i++) {
+                    split($i, kv, "=")
+                    v[NR, kv[1]] = kv[2]
+                }
+            }
+            END {
+                if(v[2, "faults_per_sec"] < v[1, "faults_per_sec"] * (1 - tol / 100))
+                    exit 1
+                if(v[2, "fault_p99_ns"] > v[1, "fault_p99_ns"] * (1 + tol / 100))
+                    exit 1
+            }' ; then
+        echo "$name regressed against $BENCH_BASELINE" >&2
+        status=1
+    fi
+done < $BENCHSPEC
+exit $status
@@ -0,0 +1,9 @@
+# name workload pages accesses procs frames blocks
+seqread seqread 128 1000000 1 256 1024
+seqwrite seqwrite 128 1000000 1 256 1024
+randread randread 128 1000000 1 256 1024
+randwrite randwrite 128 1000000 1 256 1024
+wss-seq seqwrite 256 20000 1 64 1024
+wss-rand randwrite 256 20000 1 64 1024
+contention contention 32 256 16 128 1024
+syslog syslog 64 2000 1 32 1024
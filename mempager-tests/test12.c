@@ -47,9 +47,16 @@ int main(void) {
 	}
 
 	if(!join) exit(EXIT_SUCCESS);
+	int failed = 0;
 	for(int i = 0; i < num_forks; i++) {
 		int status;
 		wait(&status);
+		if(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+			failed++;
+	}
+	if(failed) {
+		fprintf(stderr, "%d children failed\n", failed);
+		exit(EXIT_FAILURE);
 	}
 	exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,20 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "uvm.h"
+
+// syslog spanning two pages
+// first page swapped out
+int main(void) {
+	uvm_create();
+	char *page0 = uvm_extend();
+	char *page1 = uvm_extend();
+	char *page2 = uvm_extend();
+	strcpy(page0 + 4088, "hello, ");
+	strcpy(page1, "world");
+	page2[0] = 'z';
+	printf("%c\n", page2[0]);
+	uvm_syslog(page0 + 4088, 16);
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,46 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "uvm.h"
+
+// many threads faulting concurrently in one process
+int num_threads = 8;
+int num_pages = 2;
+int num_loops = 16; /* run with ./mmu 8 32 */
+
+void * worker(void *arg) {
+	int id = (int)(intptr_t)arg;
+	char **pages = malloc(num_pages * sizeof(pages[0]));
+	for(int i = 0; i < num_pages; ++i) {
+		pages[i] = uvm_extend();
+		assert(pages[i] != NULL);
+	}
+	for(int i = 0; i < num_loops; ++i) {
+		for(int j = 0; j < num_pages; ++j) {
+			char expected[16];
+			sprintf(expected, "%04d%04d", id, i);
+			assert(i == 0 || memcmp(pages[j], expected, 4) == 0);
+			strcpy(pages[j], expected);
+			assert(strcmp(pages[j], expected) == 0);
+		}
+	}
+	free(pages);
+	return NULL;
+}
+
+int main(void) {
+	uvm_create();
+	pthread_t *threads = malloc(num_threads * sizeof(threads[0]));
+	for(int i = 0; i < num_threads; ++i) {
+		pthread_create(&threads[i], NULL, worker, (void *)(intptr_t)i);
+	}
+	for(int i = 0; i < num_threads; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+	exit(EXIT_SUCCESS);
+}
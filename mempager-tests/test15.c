@@ -0,0 +1,36 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "uvm.h"
+
+// batched and vectored extends
+int main(void) {
+	uvm_create();
+	size_t PAGESIZE = sysconf(_SC_PAGESIZE);
+	size_t count;
+	char *batch = uvm_extend_batch(3, &count);
+	printf("batch %zu\n", count);
+	assert(count == 3);
+
+	struct uvm_extent ext[3] = {{NULL, 2}, {NULL, 4}, {NULL, 1}};
+	size_t total = uvm_extendv(ext, 3);
+	printf("extendv %zu %zu %zu total %zu\n", ext[0].npages,
+			ext[1].npages, ext[2].npages, total);
+	assert(ext[0].addr == batch + 3*PAGESIZE);
+	assert(ext[1].addr == batch + 5*PAGESIZE);
+	assert(ext[2].addr == NULL);
+
+	strcpy(batch + 2*PAGESIZE, "batch");
+	strcpy(ext[1].addr, "extendv");
+	uvm_syslog(batch + 2*PAGESIZE, 5);
+	uvm_syslog(ext[1].addr, 7);
+
+	char *page = uvm_extend();
+	assert(page == NULL);
+	assert(errno == ENOSPC);
+	exit(EXIT_SUCCESS);
+}
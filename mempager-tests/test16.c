@@ -0,0 +1,43 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "uvm.h"
+
+// pages swapped out in consecutive blocks come back together
+// a child evicts the parent's pages and frees its frames on exit
+int num_pages = 4; /* run with ./mmu 4 16 */
+int main(void) {
+	int go[2];
+	assert(pipe(go) == 0);
+	pid_t child = fork();
+	if(child == 0) {
+		char c;
+		close(go[1]);
+		assert(read(go[0], &c, 1) == 1);
+		uvm_create();
+		for(int i = 0; i < num_pages; ++i) {
+			char *page = uvm_extend();
+			page[0] = 'z';
+		}
+		exit(EXIT_SUCCESS);
+	}
+	close(go[0]);
+	uvm_create();
+	char *pages[num_pages];
+	for(int i = 0; i < num_pages; ++i) {
+		pages[i] = uvm_extend();
+		pages[i][0] = 'a' + i;
+	}
+	assert(write(go[1], "x", 1) == 1);
+	int status;
+	waitpid(child, &status, 0);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+	for(int i = 0; i < num_pages; ++i) printf("%c", pages[i][0]);
+	printf("\n");
+	exit(EXIT_SUCCESS);
+}
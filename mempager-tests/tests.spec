@@ -10,3 +10,7 @@
 10 4 8 0
 11 2 3 1
 12 256 1024 1
+13 2 4 0
+14 8 32 1
+15 2 8 0
+16 4 16 0 MMU_READAHEAD=4
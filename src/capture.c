@@ -0,0 +1,45 @@
+#include "capture.h"
+
+/*****************************************************************************
+ * public function implementations
+ ****************************************************************************/
+size_t capture_encode(unsigned char *buf, int kind, int64_t value, /* {{{ */
+		int32_t *last)
+{
+	uint64_t v = (uint64_t)value;
+	if(kind == CAPTURE_READ || kind == CAPTURE_WRITE) {
+		int64_t delta = value - *last;
+		*last = (int32_t)value;
+		v = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+	}
+	v = (v << 2) | (uint64_t)kind;
+	size_t n = 0;
+	do {
+		unsigned char byte = v & 0x7f;
+		v >>= 7;
+		buf[n++] = byte | (v ? 0x80 : 0);
+	} while(v);
+	return n;
+} /* }}} */
+
+size_t capture_decode(const unsigned char *buf, size_t len, int *kind, /* {{{ */
+		int64_t *value, int32_t *last)
+{
+	uint64_t v = 0;
+	size_t n = 0;
+	for(;;) {
+		if(n == len || n == CAPTURE_EVENT_MAX) return 0;
+		v |= (uint64_t)(buf[n] & 0x7f) << (7 * n);
+		if(!(buf[n++] & 0x80)) break;
+	}
+	*kind = v & 3;
+	v >>= 2;
+	if(*kind == CAPTURE_READ || *kind == CAPTURE_WRITE) {
+		int64_t delta = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+		*last += (int32_t)delta;
+		*value = *last;
+	} else {
+		*value = (int64_t)v;
+	}
+	return n;
+} /* }}} */
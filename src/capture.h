@@ -0,0 +1,54 @@
+/* This module encodes the page access traces captured by uvm clients (see
+ * UVM_CAPTURE in uvm.h) and replayed by =pagersim=.  A capture holds the
+ * accesses of one process: a =capture_header= followed by events.  Each
+ * event is a LEB128 varint whose two low bits give its kind:
+ *
+ *   CAPTURE_READ, CAPTURE_WRITE  the rest is the difference between the
+ *                                page accessed and the previous page
+ *                                accessed, zigzag-encoded;
+ *   CAPTURE_EXTEND               the rest is the number of pages added to
+ *                                the process;
+ *   CAPTURE_TICK                 the rest is the number of sampling periods
+ *                                elapsed since the previous tick.
+ *
+ * Accesses to nearby pages take a single byte. */
+
+#ifndef __CAPTURE_HEADER__
+#define __CAPTURE_HEADER__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CAPTURE_MAGIC "UVMPAGES"
+
+#define CAPTURE_READ 0
+#define CAPTURE_WRITE 1
+#define CAPTURE_EXTEND 2
+#define CAPTURE_TICK 3
+
+/* bytes taken by an event at most */
+#define CAPTURE_EVENT_MAX 10
+
+struct capture_header {
+	char magic[8];
+	uint32_t pid;
+	/* sampling period in milliseconds */
+	uint32_t period;
+	/* CLOCK_REALTIME at the start of the capture, in milliseconds */
+	uint64_t start;
+};
+
+/* This function encodes an event of type =kind= into =buf= and returns the
+ * number of bytes used.  =value= is the page accessed, the number of pages
+ * or the number of periods; =last= holds the previous page accessed and is
+ * updated. */
+size_t capture_encode(unsigned char *buf, int kind, int64_t value,
+		int32_t *last);
+
+/* This function decodes the event at the start of the =len= bytes at =buf=
+ * into =kind= and =value=, updating =last= as =capture_encode= does.  Returns
+ * the number of bytes used, or 0 if the event is truncated. */
+size_t capture_decode(const unsigned char *buf, size_t len, int *kind,
+		int64_t *value, int32_t *last);
+
+#endif
@@ -3,6 +3,9 @@
 #include <errno.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "cyc.h"
@@ -13,6 +16,28 @@
 #define CYCLIC_LINEBUF 1024
 #define CYC_FILESIZE (1<<0)
 #define CYC_PERIODIC (1<<1)
+#define CYC_RING_SIZE (1<<15)
+#define CYC_NAP_NS 1000000
+
+/* In asynchronous mode each thread formats messages into its own ring.  A
+ * ring has a single producer, its thread, and a single consumer, whoever
+ * holds the handle's =mutex=.  =head= and =tail= count the bytes ever
+ * produced and consumed. */
+struct cyc_ring {
+	char buf[CYC_RING_SIZE];
+	uint64_t head;
+	uint64_t tail;
+	/* the owning thread exited; the ring is freed once drained */
+	int dead;
+	struct cyc_ring *next;
+};
+
+/* messages are stored after this header, padded to 8 bytes */
+struct cyc_record {
+	uint64_t seq;
+	uint32_t len;
+	uint32_t pad;
+};
 
 struct cyclic {
 	int type;
@@ -25,11 +50,34 @@ struct cyclic {
 	pthread_mutex_t lock;
 	pthread_mutex_t mutex;
 	int flock;
+	/* asynchronous mode, see =cyc_set_async= */
+	int async;
+	char *vbuf;
+	unsigned flushsize;
+	unsigned interval;
+	unsigned pending;
+	uint64_t seq;
+	pthread_key_t key;
+	/* protected by =mutex= */
+	struct cyc_ring *rings;
+	pthread_t writer;
+	int running;
 };
 
 static int cyc_check_open_file(struct cyclic *cyc);
 static int cyc_open_periodic(struct cyclic *cyc);
 static int cyc_open_filesize(struct cyclic *cyc);
+static void cyc_setvbuf(struct cyclic *cyc);
+static int cyc_async_vprintf(struct cyclic *cyc, const char *fmt, va_list ap);
+static struct cyc_ring * cyc_ring_local(struct cyclic *cyc);
+static void cyc_ring_exit(void *vring);
+static void cyc_ring_write(struct cyc_ring *r, uint64_t pos, const void *data,
+		size_t len);
+static void cyc_ring_read(struct cyc_ring *r, uint64_t pos, void *data,
+		size_t len);
+static int cyc_drain(struct cyclic *cyc);
+static uint64_t cyc_now_ms(void);
+static void * cyc_writer(void *vcyc);
 
 /*****************************************************************************
  * cyclic function implementations
@@ -48,6 +96,9 @@ struct cyclic * cyc_init_periodic(const char *prefix, unsigned period) /* {{{ */
 	cyc->period = period;
 	cyc->period_start = 0;
 	cyc->file = NULL;
+	cyc->async = 0;
+	cyc->vbuf = NULL;
+	cyc->rings = NULL;
 	if(pthread_mutex_init(&(cyc->lock), NULL)) goto out;
 	if(pthread_mutex_init(&(cyc->mutex), NULL)) goto out;
 	cyc->flock = 0;
@@ -75,6 +126,9 @@ struct cyclic * cyc_init_filesize(const char *prefix, /* {{{ */
 	cyc->period = -1;
 	cyc->period_start = -1;
 	cyc->file = NULL;
+	cyc->async = 0;
+	cyc->vbuf = NULL;
+	cyc->rings = NULL;
 	if(pthread_mutex_init(&(cyc->lock), NULL)) goto out;
 	if(pthread_mutex_init(&(cyc->mutex), NULL)) goto out;
 	cyc->flock = 0;
@@ -87,8 +141,55 @@ struct cyclic * cyc_init_filesize(const char *prefix, /* {{{ */
 	return NULL;
 } /* }}} */
 
+int cyc_set_async(struct cyclic *cyc, unsigned flushsize, /* {{{ */
+		unsigned interval)
+{
+	if(cyc->async) return 1;
+	if(flushsize == 0) flushsize = BUFSIZ;
+	cyc->vbuf = malloc(flushsize);
+	if(!cyc->vbuf) goto out;
+	errno = pthread_key_create(&cyc->key, cyc_ring_exit);
+	if(errno) goto out_vbuf;
+	cyc->flushsize = flushsize;
+	cyc->interval = interval;
+	cyc->pending = 0;
+	cyc->seq = 0;
+	cyc->running = 1;
+	pthread_mutex_lock(&cyc->mutex);
+	/* an open file keeps its buffer until the next rotation */
+	cyc->async = 1;
+	pthread_mutex_unlock(&cyc->mutex);
+	errno = pthread_create(&cyc->writer, NULL, cyc_writer, cyc);
+	if(errno) {
+		cyc->async = 0;
+		pthread_key_delete(cyc->key);
+		goto out_vbuf;
+	}
+	return 1;
+
+	out_vbuf:
+	{ int tmp = errno;
+	free(cyc->vbuf);
+	cyc->vbuf = NULL;
+	errno = tmp; }
+	out:
+	perror("cyc_set_async");
+	return 0;
+} /* }}} */
+
 void cyc_destroy(struct cyclic *cyc) /* {{{ */
 {
+	if(cyc->async) {
+		/* the writer drains all rings before it returns */
+		__atomic_store_n(&cyc->running, 0, __ATOMIC_RELEASE);
+		pthread_join(cyc->writer, NULL);
+		pthread_key_delete(cyc->key);
+		while(cyc->rings) {
+			struct cyc_ring *r = cyc->rings;
+			cyc->rings = r->next;
+			free(r);
+		}
+	}
 	if(cyc->file) {
 		int oldstate;
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
@@ -96,6 +197,7 @@ void cyc_destroy(struct cyclic *cyc) /* {{{ */
 		pthread_setcancelstate(oldstate, &oldstate);
 	}
 	pthread_mutex_destroy(&(cyc->mutex));
+	free(cyc->vbuf);
 	free(cyc->prefix);
 	free(cyc);
 } /* }}} */
@@ -107,6 +209,11 @@ int cyc_printf(struct cyclic *cyc, const char *fmt, ...) /* {{{ */
 	int oldstate;
 	int cnt = 0;
 	va_start(ap, fmt);
+	if(cyc->async) {
+		cnt = cyc_async_vprintf(cyc, fmt, ap);
+		va_end(ap);
+		return cnt;
+	}
 	pthread_mutex_lock(&cyc->mutex);
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
 	if(cyc_check_open_file(cyc)) {
@@ -125,6 +232,7 @@ int cyc_vprintf(struct cyclic *cyc, const char *fmt, va_list ap) /* {{{ */
 	char line[CYCLIC_LINEBUF];
 	int oldstate;
 	int cnt = 0;
+	if(cyc->async) return cyc_async_vprintf(cyc, fmt, ap);
 	pthread_mutex_lock(&cyc->mutex);
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
 	if(cyc_check_open_file(cyc)) {
@@ -141,6 +249,7 @@ void cyc_flush(struct cyclic *cyc) /* {{{ */
 {
 	int oldstate;
 	pthread_mutex_lock(&cyc->mutex);
+	if(cyc->async) cyc_drain(cyc);
 	if(!cyc->file) {
 		pthread_mutex_unlock(&cyc->mutex);
 		return;
@@ -212,7 +321,7 @@ static int cyc_open_periodic(struct cyclic *cyc) /* {{{ */
 	cyc->file = fopen(fname, "w");
 	free(fname);
 	if(!cyc->file) return 0;
-	setvbuf(cyc->file, NULL, _IOLBF, 0);
+	cyc_setvbuf(cyc);
 	return 1;
 } /* }}} */
 
@@ -241,7 +350,7 @@ static int cyc_open_filesize(struct cyclic *cyc) /* {{{ */
 	cyc->file = fopen(fname, "w");
 	free(fname);
 	if(!cyc->file) return 0;
-	if(setvbuf(cyc->file, NULL, _IOLBF, 0));
+	cyc_setvbuf(cyc);
 	return 1;
 
 	out_fname:
@@ -250,3 +359,144 @@ static int cyc_open_filesize(struct cyclic *cyc) /* {{{ */
 	errno = tmp; }
 	return 0;
 } /* }}} */
+
+static void cyc_setvbuf(struct cyclic *cyc) /* {{{ */
+{
+	/* the asynchronous writer leaves batching to stdio: the buffer is
+	 * written when full and flushed by =cyc_writer= on a timer */
+	if(cyc->async) setvbuf(cyc->file, cyc->vbuf, _IOFBF, cyc->flushsize);
+	else setvbuf(cyc->file, NULL, _IOLBF, 0);
+} /* }}} */
+
+static int cyc_async_vprintf(struct cyclic *cyc, const char *fmt, /* {{{ */
+		va_list ap)
+{
+	struct cyc_ring *r = cyc_ring_local(cyc);
+	if(!r) return 0;
+	char line[CYCLIC_LINEBUF];
+	int len = vsnprintf(line, CYCLIC_LINEBUF, fmt, ap);
+	if(len < 0) return 0;
+	if(len >= CYCLIC_LINEBUF) len = CYCLIC_LINEBUF - 1;
+	struct cyc_record rec = {.len = len, .pad = 0};
+	size_t need = sizeof(rec) + ((len + 7) & ~7);
+	while(CYC_RING_SIZE - (r->head - __atomic_load_n(&r->tail,
+			__ATOMIC_ACQUIRE)) < need)
+		sched_yield();
+	rec.seq = __atomic_fetch_add(&cyc->seq, 1, __ATOMIC_RELAXED);
+	cyc_ring_write(r, r->head, &rec, sizeof(rec));
+	cyc_ring_write(r, r->head + sizeof(rec), line, len);
+	__atomic_store_n(&r->head, r->head + need, __ATOMIC_RELEASE);
+	return len;
+} /* }}} */
+
+static struct cyc_ring * cyc_ring_local(struct cyclic *cyc) /* {{{ */
+{
+	struct cyc_ring *r = pthread_getspecific(cyc->key);
+	if(r) return r;
+	r = calloc(1, sizeof(*r));
+	if(!r) return NULL;
+	pthread_mutex_lock(&cyc->mutex);
+	r->next = cyc->rings;
+	cyc->rings = r;
+	pthread_mutex_unlock(&cyc->mutex);
+	pthread_setspecific(cyc->key, r);
+	return r;
+} /* }}} */
+
+static void cyc_ring_exit(void *vring) /* {{{ */
+{
+	struct cyc_ring *r = vring;
+	__atomic_store_n(&r->dead, 1, __ATOMIC_RELEASE);
+} /* }}} */
+
+static void cyc_ring_write(struct cyc_ring *r, uint64_t pos, /* {{{ */
+		const void *data, size_t len)
+{
+	size_t off = pos % CYC_RING_SIZE;
+	size_t first = CYC_RING_SIZE - off;
+	if(first > len) first = len;
+	memcpy(r->buf + off, data, first);
+	memcpy(r->buf, (const char *)data + first, len - first);
+} /* }}} */
+
+static void cyc_ring_read(struct cyc_ring *r, uint64_t pos, void *data, /* {{{ */
+		size_t len)
+{
+	size_t off = pos % CYC_RING_SIZE;
+	size_t first = CYC_RING_SIZE - off;
+	if(first > len) first = len;
+	memcpy(data, r->buf + off, first);
+	memcpy((char *)data + first, r->buf, len - first);
+} /* }}} */
+
+static int cyc_drain(struct cyclic *cyc) /* {{{ */
+{
+	/* must be called with =mutex= held.  Writes pending messages in
+	 * sequence order and returns the number of bytes written. */
+	int written = 0;
+	char line[CYCLIC_LINEBUF];
+	for(;;) {
+		struct cyc_ring *min = NULL;
+		struct cyc_record rec, minrec;
+		for(struct cyc_ring *r = cyc->rings; r; r = r->next) {
+			if(r->tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE))
+				continue;
+			cyc_ring_read(r, r->tail, &rec, sizeof(rec));
+			if(!min || rec.seq < minrec.seq) {
+				min = r;
+				minrec = rec;
+			}
+		}
+		if(!min) break;
+		cyc_ring_read(min, min->tail + sizeof(minrec), line, minrec.len);
+		__atomic_store_n(&min->tail, min->tail + sizeof(minrec)
+				+ ((minrec.len + 7) & ~7), __ATOMIC_RELEASE);
+		if(!cyc_check_open_file(cyc)) continue;
+		written += fwrite(line, 1, minrec.len, cyc->file);
+	}
+	struct cyc_ring **link = &cyc->rings;
+	while(*link) {
+		struct cyc_ring *r = *link;
+		if(__atomic_load_n(&r->dead, __ATOMIC_ACQUIRE)
+				&& r->tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) {
+			*link = r->next;
+			free(r);
+			continue;
+		}
+		link = &r->next;
+	}
+	cyc->pending += written;
+	return written;
+} /* }}} */
+
+static uint64_t cyc_now_ms(void) /* {{{ */
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+} /* }}} */
+
+static void * cyc_writer(void *vcyc) /* {{{ */
+{
+	struct cyclic *cyc = vcyc;
+	const struct timespec nap = {0, CYC_NAP_NS};
+	uint64_t last = cyc_now_ms();
+	while(__atomic_load_n(&cyc->running, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&cyc->mutex);
+		int written = cyc_drain(cyc);
+		uint64_t now = cyc_now_ms();
+		if(cyc->pending && now - last >= cyc->interval) {
+			if(cyc->file) fflush(cyc->file);
+			cyc->pending = 0;
+			last = now;
+		}
+		pthread_mutex_unlock(&cyc->mutex);
+		if(!written) nanosleep(&nap, NULL);
+	}
+	/* messages logged before =cyc_destroy= was called */
+	pthread_mutex_lock(&cyc->mutex);
+	cyc_drain(cyc);
+	if(cyc->file) fflush(cyc->file);
+	pthread_mutex_unlock(&cyc->mutex);
+	return NULL;
+} /* }}} */
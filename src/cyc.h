@@ -29,18 +29,29 @@ struct cyclic * cyc_init_periodic(const char *prefix, unsigned period);
 struct cyclic * cyc_init_filesize(const char *prefix, unsigned nbackups,
 		unsigned maxsize);
 
-/* This function closes the cyclic file handle and frees used memory. */
+/* This function makes printing to =cyc= asynchronous.  Messages are formatted
+ * by the calling thread into a lock-free buffer of its own; a background
+ * thread writes them to the file in the order they were printed, rotating
+ * files as usual.  The file is written whenever =flushsize= bytes are
+ * buffered and flushed at least every =interval= milliseconds.  Returns
+ * nonzero on success. */
+int cyc_set_async(struct cyclic *cyc, unsigned flushsize, unsigned interval);
+
+/* This function closes the cyclic file handle and frees used memory.  Pending
+ * asynchronous messages are written first. */
 void cyc_destroy(struct cyclic *cyc);
 
 /* These functions behave similarly to printf and vprintf and return the number
  * of bytes written.  File age and file size, depending on the type of cyclic
  * handle, are checked before printing the message.  This guarantees that that
  * the whole message will be in one file.  These functions flush the output
- * files to disk. */
+ * files to disk, unless the handle is asynchronous. */
 int cyc_printf(struct cyclic *cyc, const char *fmt, ...);
 int cyc_vprintf(struct cyclic *cyc, const char *fmt, va_list ap);
 
-/* This function flushes the current file to disk. */
+/* This function flushes the current file to disk.  Pending asynchronous
+ * messages are written first, so this function can be called before exiting
+ * on fatal errors. */
 void cyc_flush(struct cyclic *cyc);
 
 /* This function prevents the current file from changing; they are not
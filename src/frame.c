@@ -0,0 +1,115 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "frame.h"
+
+/*****************************************************************************
+ * static function declarations
+ ****************************************************************************/
+static int frame_fill(struct frame_reader *r);
+
+/*****************************************************************************
+ * public function implementations
+ ****************************************************************************/
+void frame_reader_init(struct frame_reader *r, int fd, /* {{{ */
+		size_t (*msgsize)(uint32_t type))
+{
+	r->fd = fd;
+	r->version = MMU_PROTO_V1;
+	r->msgsize = msgsize;
+	r->head = 0;
+	r->tail = 0;
+} /* }}} */
+
+int frame_read(struct frame_reader *r, const void **msg, size_t *len) /* {{{ */
+{
+	for(;;) {
+		const char *p = r->buf + r->head;
+		size_t avail = r->tail - r->head;
+		size_t hdr = 0;
+		size_t need = 0;
+		if(r->version >= MMU_PROTO_V2) {
+			hdr = sizeof(struct mmu_proto_frame);
+			if(avail >= hdr) {
+				struct mmu_proto_frame f;
+				memcpy(&f, p, hdr);
+				need = f.len;
+				if(need < sizeof(uint32_t) || need > FRAME_BUF - hdr) {
+					errno = EPROTO;
+					return -1;
+				}
+			}
+		} else if(avail >= sizeof(uint32_t)) {
+			uint32_t type;
+			memcpy(&type, p, sizeof(type));
+			need = r->msgsize(type);
+			if(!need) {
+				errno = EPROTO;
+				return -1;
+			}
+		}
+		if(need && avail >= hdr + need) {
+			*msg = p + hdr;
+			*len = need;
+			r->head += hdr + need;
+			return 0;
+		}
+		if(frame_fill(r)) return -1;
+	}
+} /* }}} */
+
+size_t frame_encode(int version, void *buf, const void *msg, size_t len) /* {{{ */
+{
+	if(version < MMU_PROTO_V2) {
+		memcpy(buf, msg, len);
+		return len;
+	}
+	struct mmu_proto_frame f = {.len = (uint32_t)len};
+	memcpy(buf, &f, sizeof(f));
+	memcpy((char *)buf + sizeof(f), msg, len);
+	return sizeof(f) + len;
+} /* }}} */
+
+ssize_t frame_send(int fd, int version, const void *msg, size_t len) /* {{{ */
+{
+	if(version < MMU_PROTO_V2) return send(fd, msg, len, 0);
+	struct mmu_proto_frame f = {.len = (uint32_t)len};
+	struct iovec iov[2] = {
+		{.iov_base = &f, .iov_len = sizeof(f)},
+		{.iov_base = (void *)msg, .iov_len = len},
+	};
+	struct msghdr mh = {.msg_iov = iov, .msg_iovlen = 2};
+	ssize_t cnt = sendmsg(fd, &mh, 0);
+	if(cnt == -1) return -1;
+	return cnt < (ssize_t)sizeof(f) ? 0 : cnt - (ssize_t)sizeof(f);
+} /* }}} */
+
+int frame_negotiate(uint32_t requested) /* {{{ */
+{
+	if(requested < MMU_PROTO_V1) return MMU_PROTO_V1;
+	if(requested > MMU_PROTO_VERSION) return MMU_PROTO_VERSION;
+	return (int)requested;
+} /* }}} */
+
+/*****************************************************************************
+ * static function implementations
+ ****************************************************************************/
+int frame_fill(struct frame_reader *r) /* {{{ */
+{
+	/* keep the unread bytes at the start so the rest of the buffer is
+	 * free for the next recv */
+	if(r->head > 0) {
+		memmove(r->buf, r->buf + r->head, r->tail - r->head);
+		r->tail -= r->head;
+		r->head = 0;
+	}
+	ssize_t cnt;
+	do {
+		cnt = recv(r->fd, r->buf + r->tail, FRAME_BUF - r->tail, 0);
+	} while(cnt == -1 && errno == EINTR);
+	if(cnt <= 0) return -1;
+	r->tail += (size_t)cnt;
+	return 0;
+} /* }}} */
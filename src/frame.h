@@ -0,0 +1,59 @@
+/* This module reads and writes the messages of the MMU protocol (see
+ * mmuproto.h) over a stream socket.  Under MMU_PROTO_V1 a message is sent
+ * as-is and its size follows from its type; under MMU_PROTO_V2 each message
+ * is preceded by a =mmu_proto_frame= holding its length, so receivers can
+ * skip messages of unknown types and accept longer or shorter versions of
+ * the messages they know.
+ *
+ * A =frame_reader= buffers what it receives, so a single =recv= usually
+ * brings in several messages and =frame_read= hands them out without
+ * further system calls. */
+
+#ifndef __FRAME_HEADER__
+#define __FRAME_HEADER__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "mmuproto.h"
+
+#define FRAME_BUF 8192
+
+struct frame_reader {
+	int fd;
+	int version;
+	/* size of an MMU_PROTO_V1 message of the given type, 0 if unknown */
+	size_t (*msgsize)(uint32_t type);
+	/* unread bytes are in =buf[head:tail]= */
+	size_t head;
+	size_t tail;
+	char buf[FRAME_BUF];
+};
+
+/* This function prepares =r= to read MMU_PROTO_V1 messages from =fd=.  The
+ * caller changes =r->version= once one is negotiated. */
+void frame_reader_init(struct frame_reader *r, int fd,
+		size_t (*msgsize)(uint32_t type));
+
+/* This function stores in =msg= and =len= the next message read from
+ * =r->fd=, receiving more bytes if needed.  The message stays valid until
+ * the next call.  Returns 0 on success; returns -1 at the end of the stream
+ * or on error, with =errno= set to EPROTO if the peer sent a malformed
+ * message. */
+int frame_read(struct frame_reader *r, const void **msg, size_t *len);
+
+/* This function writes into =buf= the =len= bytes of =msg= framed as
+ * =version= requires and returns the number of bytes written, at most =len=
+ * plus =sizeof(struct mmu_proto_frame)=. */
+size_t frame_encode(int version, void *buf, const void *msg, size_t len);
+
+/* This function sends =msg= to =fd= framed as =version= requires.  Returns
+ * the number of bytes of =msg= sent, as =send= would. */
+ssize_t frame_send(int fd, int version, const void *msg, size_t len);
+
+/* This function returns the version to use with a peer that asked for
+ * =requested=; peers that do not say use MMU_PROTO_V1. */
+int frame_negotiate(uint32_t requested);
+
+#endif
@@ -0,0 +1,102 @@
+#include <stdint.h>
+
+#include "hex.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HEX_X86 1
+#endif
+
+/*****************************************************************************
+ * static function declarations
+ ****************************************************************************/
+static const char hex_digits[] = "0123456789abcdef";
+
+static size_t hex_encode_scalar(char *dst, const uint8_t *src, size_t len);
+#ifdef HEX_X86
+static size_t hex_encode_sse2(char *dst, const uint8_t *src, size_t len);
+static size_t hex_encode_avx2(char *dst, const uint8_t *src, size_t len);
+#endif
+
+/*****************************************************************************
+ * public function implementations
+ ****************************************************************************/
+void hex_encode(char *dst, const void *src, size_t len) /* {{{ */
+{
+	const uint8_t *s = src;
+	size_t done = 0;
+	#ifdef HEX_X86
+	static int has_avx2 = -1;
+	if(has_avx2 == -1) has_avx2 = __builtin_cpu_supports("avx2");
+	if(has_avx2) done = hex_encode_avx2(dst, s, len);
+	done += hex_encode_sse2(dst + 2*done, s + done, len - done);
+	#endif
+	hex_encode_scalar(dst + 2*done, s + done, len - done);
+} /* }}} */
+
+/*****************************************************************************
+ * static function implementations
+ ****************************************************************************/
+static size_t hex_encode_scalar(char *dst, const uint8_t *src, size_t len) /* {{{ */
+{
+	for(size_t i = 0; i < len; ++i) {
+		dst[2*i] = hex_digits[src[i] >> 4];
+		dst[2*i+1] = hex_digits[src[i] & 0x0f];
+	}
+	return len;
+} /* }}} */
+
+#ifdef HEX_X86
+/* Both kernels split each byte into nibbles, interleave them high nibble
+ * first, and map nibble n to n + '0', plus ('a' - '0' - 10) when n > 9.
+ * They return the number of input bytes consumed. */
+static size_t hex_encode_sse2(char *dst, const uint8_t *src, size_t len) /* {{{ */
+{
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i zero = _mm_set1_epi8('0');
+	const __m128i alpha = _mm_set1_epi8('a' - '0' - 10);
+	size_t i = 0;
+	for(; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i lo = _mm_and_si128(v, mask);
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+		__m128i a = _mm_unpacklo_epi8(hi, lo);
+		__m128i b = _mm_unpackhi_epi8(hi, lo);
+		a = _mm_add_epi8(_mm_add_epi8(a, zero),
+				_mm_and_si128(_mm_cmpgt_epi8(a, nine), alpha));
+		b = _mm_add_epi8(_mm_add_epi8(b, zero),
+				_mm_and_si128(_mm_cmpgt_epi8(b, nine), alpha));
+		_mm_storeu_si128((__m128i *)(dst + 2*i), a);
+		_mm_storeu_si128((__m128i *)(dst + 2*i + 16), b);
+	}
+	return i;
+} /* }}} */
+
+__attribute__((target("avx2")))
+static size_t hex_encode_avx2(char *dst, const uint8_t *src, size_t len) /* {{{ */
+{
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	const __m256i nine = _mm256_set1_epi8(9);
+	const __m256i zero = _mm256_set1_epi8('0');
+	const __m256i alpha = _mm256_set1_epi8('a' - '0' - 10);
+	size_t i = 0;
+	for(; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i lo = _mm256_and_si256(v, mask);
+		__m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), mask);
+		/* unpack works within 128-bit lanes; fix the order below */
+		__m256i a = _mm256_unpacklo_epi8(hi, lo);
+		__m256i b = _mm256_unpackhi_epi8(hi, lo);
+		a = _mm256_add_epi8(_mm256_add_epi8(a, zero),
+				_mm256_and_si256(_mm256_cmpgt_epi8(a, nine), alpha));
+		b = _mm256_add_epi8(_mm256_add_epi8(b, zero),
+				_mm256_and_si256(_mm256_cmpgt_epi8(b, nine), alpha));
+		_mm256_storeu_si256((__m256i *)(dst + 2*i),
+				_mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256((__m256i *)(dst + 2*i + 32),
+				_mm256_permute2x128_si256(a, b, 0x31));
+	}
+	return i;
+} /* }}} */
+#endif
@@ -0,0 +1,16 @@
+/* This module converts binary buffers to lowercase hexadecimal text.  On x86
+ * processors the conversion uses SSE2 or, when the processor supports it,
+ * AVX2 instructions selected at run time; other architectures use a portable
+ * table-driven loop. */
+
+#ifndef __HEX_HEADER__
+#define __HEX_HEADER__
+
+#include <stddef.h>
+
+/* This function writes the =2*len= hexadecimal digits representing the =len=
+ * bytes at =src= to =dst=, most significant nibble first.  The output is not
+ * NUL-terminated.  =src= and =dst= must not overlap. */
+void hex_encode(char *dst, const void *src, size_t len);
+
+#endif
@@ -11,7 +11,7 @@ extern int errno;
 /*****************************************************************************
  * static variables
  ****************************************************************************/
-static unsigned log_verbosity = 0;
+unsigned log_verbosity = 0;
 static struct cyclic *cyc = NULL;
 
 static void log_error(const char *file, int line);
@@ -42,7 +42,13 @@ void log_flush(void)
 	cyc_flush(cyc);
 }
 
-void logd(unsigned int verbosity, const char *fmt, ...)
+void log_async(unsigned flushsize, unsigned interval)
+{
+	if(!cyc) return;
+	if(!cyc_set_async(cyc, flushsize, interval)) log_error(__FILE__, __LINE__);
+}
+
+void log_printf(unsigned int verbosity, const char *fmt, ...)
 {
 	if(!cyc) return;
 	va_list ap;
@@ -77,6 +83,7 @@ void logea(const char *file, int lineno, const char *msg)
 	}
 	errno = myerrno;
 	loge(0, file, lineno);
+	cyc_flush(cyc);
 	exit(EXIT_FAILURE);
 }
 
@@ -7,6 +7,10 @@
  * (2) print messages to the file using =logd=, =loge=, and =logea=
  * (3) destroy the logging handler with =log_destroy= when you are done.
  *
+ * Calls to =logd= with a =verbosity= above =LOG_MAX_VERBOSITY= are removed at
+ * compile time.  Define it before including this header, or on the compiler's
+ * command line, to drop debugging messages from a build.
+ *
  * This code is copyrighted by Italo Cunha (cunha@dcc.ufmg.br) and released
  * under the latest version of the GPL. */
 
@@ -22,6 +26,16 @@
 #define LOG_DEBUG 500
 #define LOG_EXTRA 1000
 
+/* a reasonable batch size for =log_async= */
+#define LOG_ASYNC_FLUSHSIZE (1<<16)
+
+#ifndef LOG_MAX_VERBOSITY
+#define LOG_MAX_VERBOSITY LOG_EXTRA
+#endif
+
+/* the =verbosity= passed to =log_init=, zero while logging is off */
+extern unsigned log_verbosity;
+
 /* This function initializes the global logger.  The parameter =verbosity=
  * specifies what gets printed; calls to =logd=, =loge=, and =logea= with lower
  * =verbosity= values will print messages.  The variable =prefix= controls the
@@ -34,9 +48,24 @@ void log_init(unsigned verbosity, const char *prefix, unsigned nbackups,
 void log_destroy(void);
 void log_flush(void);
 
-/* This function functions like printf and logs a message if its =verbosity= is
- * lower than that passed to =log_init=. */
-void logd(unsigned verbosity, const char *fmt, ...);
+/* This function makes logging asynchronous: messages are formatted by the
+ * calling thread and written by a background thread in batches of up to
+ * =flushsize= bytes, flushed at least every =interval= milliseconds.  Pending
+ * messages are written by =log_flush=, =log_destroy=, and =logea=. */
+void log_async(unsigned flushsize, unsigned interval);
+
+/* This macro functions like printf and logs a message if its =verbosity= is
+ * lower than that passed to =log_init=.  Arguments are only evaluated if the
+ * message is logged. */
+#define logd(verbosity, ...) do { \
+	if((verbosity) <= LOG_MAX_VERBOSITY \
+			&& __builtin_expect((verbosity) <= log_verbosity, 0)) \
+		log_printf((verbosity), __VA_ARGS__); \
+} while(0)
+
+/* This function implements =logd= without the checks inlined by the macro. */
+void log_printf(unsigned verbosity, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
 
 /* This functions prints an error message (built with strerror) if =ernno= is
  * set and =verbosity= is lower than that passed to =log_init=.  It should be
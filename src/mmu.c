@@ -7,6 +7,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdlib.h>
@@ -14,37 +15,120 @@
 #include <string.h>
 #include <unistd.h>
 
+#ifndef MMULOG
+/* the log is never opened; compile logging out */
+#define LOG_MAX_VERBOSITY 0
+#endif
 #include "log.h"
+#include "stats.h"
+#include "trace.h"
 
 #include "pager.h"
 #include "mmuproto.h"
+#include "frame.h"
 
 #define MMU_MAX_EVENTS 32
 #define MMU_MAX_SOCK 1024
+#define MMU_CLIENT_WORKERS 4
+/* =pid2client= has 1 << MMU_PID_BITS chains */
+#define MMU_PID_BITS 10
+#define MMU_BATCH_MAX 64
+/* at most one deferred invalidation per page a process may have */
+#define MMU_INVAL_MAX 256
 
 
-pid_t id2pid[UINT8_MAX];
-uint8_t nextid = 0;
-
 /****************************************************************************
  * structure definitions and static variables
  ***************************************************************************/
 struct mmu_data {/*{{{*/
 	int running;
+	/* defer PROT_NONE changes to idle clients (MMU_LAZY_INVALIDATE) */
+	int lazy;
 	int npages;
+	int nblocks;
 	char *pmem;
 	char *disk;
+	/* =disk_fd= is the swap file under MMU_PERSIST, -1 otherwise */
+	int disk_fd;
 	char *pmem_fn;
 	int pmem_fd;
 	int sock;
+	/* =mutex= protects =sock2client=, =pid2client=, =nextid= and
+	 * =nclients= */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int nclients;
 	struct mmu_client * sock2client[MMU_MAX_SOCK];
+	/* clients that sent CREATE_REQ, chained by =hnext= and hashed by
+	 * pid; =nextid= numbers them in the trace, and is wide enough
+	 * that ids are not reused in practice */
+	struct mmu_client * pid2client[1 << MMU_PID_BITS];
+	uint32_t nextid;
+};/*}}}*/
+struct mmu_request {/*{{{*/
+	struct mmu_request *next;
+	union {
+		uint32_t type;
+		/* CREATE requests read with a zero =version= */
+		struct mmu_proto_create2_req create;
+		struct mmu_proto_extend_req extend;
+		struct mmu_proto_extendv_req extendv;
+		struct mmu_proto_syslog_req syslog;
+		struct mmu_proto_stats_req stats;
+		struct mmu_proto_segv_req segv;
+		struct mmu_proto_exit_req exit;
+	} msg;
+};/*}}}*/
+struct mmu_outbound {/*{{{*/
+	struct mmu_outbound *next;
+	size_t len;
+	char msg[];
 };/*}}}*/
 struct mmu_client {/*{{{*/
 	int running;
 	int sock;
 	pid_t pid;
+	uint32_t id;
+	struct mmu_client *hnext;
+	/* =thread= reads messages from the socket through =reader=,
+	 * queues requests for the =workers= and counts acknowledgements of
+	 * REMAP and CHPROT messages */
 	pthread_t thread;
+	struct frame_reader reader;
+	pthread_t workers[MMU_CLIENT_WORKERS];
+	/* =sender= writes the messages queued from =out_head= to the
+	 * socket, so threads sending to the client never block on it;
+	 * =sending= is set while it writes one */
+	pthread_t sender;
+	/* =mutex= protects the fields below */
+	pthread_mutex_t mutex;
+	pthread_cond_t work;
+	pthread_cond_t ack;
+	pthread_cond_t out;
+	struct mmu_request *head;
+	struct mmu_request *tail;
+	int active;
+	struct mmu_outbound *out_head;
+	struct mmu_outbound *out_tail;
+	int sending;
+	/* framing of messages queued from now on */
+	int version;
+	uint64_t sent;
+	uint64_t acked;
+	/* pages whose PROT_NONE change was deferred while the client had
+	 * no request in progress; sent before any other message */
+	intptr_t inval[MMU_INVAL_MAX];
+	int ninval;
+};/*}}}*/
+/* REMAP and CHPROT messages a thread sent inside =mmu_batch_begin= and
+ * =mmu_batch_end=: the last sequence number sent to each client */
+struct mmu_batch {/*{{{*/
+	int depth;
+	int n;
+	struct mmu_client *clients[MMU_BATCH_MAX];
+	uint64_t seqs[MMU_BATCH_MAX];
 };/*}}}*/
+static __thread struct mmu_batch batch;
 static struct mmu_data *mmu = NULL;
 const char *pmem = NULL;
 static size_t PAGESIZE = 0;
@@ -55,14 +139,15 @@ static size_t PAGESIZE = 0;
 static void mmu_destroy(void);
 static void mmu_client_destroy(struct mmu_client *c);
 static void mmu_shutdown_action(int signum, siginfo_t *si, void *context);
+static void * mmu_stats_thread(void *data);
 static void mmu_accept_loop(void);
 static void * mmu_client_thread(void *vclient);
+static void * mmu_client_worker(void *vclient);
+static void * mmu_client_sender(void *vclient);
+static size_t mmu_client_msgsize(uint32_t type);
 
-int get_pid_id(pid_t pid) {
-	int i = 0;
-	for(; id2pid[i] != pid; i++);
-	return i;
-}
+static struct mmu_client ** mmu_client_bucket(pid_t pid);
+static void mmu_client_unhash(struct mmu_client *c);
 
 /****************************************************************************
  * initialization functions {{{
@@ -72,6 +157,7 @@ static void mmu_init_disk(int nblocks);
 static void mmu_init_pmem(int npages);
 static void mmu_init_sock(void);
 static void mmu_init_sigs(void);
+static void mmu_notify_ready(void);
 
 void mmu_init(int npages, int nblocks)/*{{{*/
 {
@@ -81,20 +167,48 @@ void mmu_init(int npages, int nblocks)/*{{{*/
 	if(!mmu) logea(__FILE__, __LINE__, NULL);
 	mmu->running = 1;
 	mmu->npages = npages;
+	mmu->nblocks = nblocks;
+	mmu->lazy = getenv("MMU_LAZY_INVALIDATE") != NULL;
 
 	mmu_init_disk(nblocks);
 	mmu_init_pmem(npages);
 	mmu_init_sock();
 	mmu_init_sigs();
+	pthread_mutex_init(&mmu->mutex, NULL);
+	pthread_cond_init(&mmu->cond, NULL);
+	mmu->nclients = 0;
 	memset(mmu->sock2client, 0, MMU_MAX_SOCK*sizeof(mmu->sock2client[0]));
+	memset(mmu->pid2client, 0, sizeof(mmu->pid2client));
+	mmu->nextid = 0;
 }/*}}}*/
 
 void mmu_init_disk(int nblocks)/*{{{*/
 {
 	size_t disksz = PAGESIZE * nblocks;
-	mmu->disk = malloc(disksz);
-	if(!mmu->disk) logea(__FILE__, __LINE__, NULL);
-	logd(LOG_INFO, "%s: %zu bytes in %d blocks\n", __func__, disksz, nblocks);
+	const char *dir = getenv("MMU_PERSIST");
+	mmu->disk_fd = -1;
+	if(!dir) {
+		mmu->disk = malloc(disksz);
+		if(!mmu->disk) logea(__FILE__, __LINE__, NULL);
+		logd(LOG_INFO, "%s: %zu bytes in %d blocks\n", __func__, disksz,
+				nblocks);
+		return;
+	}
+	/* blocks survive restarts in a file the pager's snapshot refers to */
+	char path[PATH_MAX];
+	if(snprintf(path, PATH_MAX, "%s/mmu.swap", dir) >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		logea(__FILE__, __LINE__, dir);
+	}
+	mmu->disk_fd = open(path, O_RDWR | O_CREAT, 0600);
+	if(mmu->disk_fd == -1) logea(__FILE__, __LINE__, path);
+	if(ftruncate(mmu->disk_fd, disksz) == -1)
+		logea(__FILE__, __LINE__, path);
+	int prot = PROT_READ | PROT_WRITE;
+	mmu->disk = mmap(NULL, disksz, prot, MAP_SHARED, mmu->disk_fd, 0);
+	if(mmu->disk == MAP_FAILED) logea(__FILE__, __LINE__, path);
+	logd(LOG_INFO, "%s: %zu bytes in %d blocks at %s\n", __func__, disksz,
+			nblocks, path);
 }/*}}}*/
 
 void mmu_init_pmem(int npages)/*{{{*/
@@ -107,9 +221,14 @@ void mmu_init_pmem(int npages)/*{{{*/
 			mmu->pmem_fn);
 
 	size_t memsz = PAGESIZE * npages;
-	for(size_t i = 0; i < npages*PAGESIZE; ++i) {
-		write(mmu->pmem_fd, "z", 1);
+	char *fill = malloc(PAGESIZE);
+	if(!fill) logea(__FILE__, __LINE__, NULL);
+	memset(fill, 'z', PAGESIZE);
+	for(int i = 0; i < npages; ++i) {
+		if(write(mmu->pmem_fd, fill, PAGESIZE) != PAGESIZE)
+			logea(__FILE__, __LINE__, mmu->pmem_fn);
 	}
+	free(fill);
 
 	int prot = PROT_READ | PROT_WRITE;
 	mmu->pmem = mmap(NULL, memsz, prot, MAP_SHARED, mmu->pmem_fd, 0);
@@ -135,6 +254,17 @@ void mmu_init_sock(void)/*{{{*/
 			MMU_PROTO_UNIX_PATH);
 }/*}}}*/
 
+void mmu_notify_ready(void)/*{{{*/
+{
+	/* whoever started us waits on this descriptor rather than sleeping */
+	const char *env = getenv("MMU_READY_FD");
+	if(!env) return;
+	int fd = atoi(env);
+	if(write(fd, "ready\n", 6) != 6) logea(__FILE__, __LINE__, "MMU_READY_FD");
+	close(fd);
+	logd(LOG_INFO, "%s: readiness signaled on fd %d\n", __func__, fd);
+}/*}}}*/
+
 void mmu_init_sigs(void)/*{{{*/
 {
 	struct sigaction new;
@@ -143,6 +273,14 @@ void mmu_init_sigs(void)/*{{{*/
 	new.sa_sigaction = mmu_shutdown_action;
 	sigaction(SIGINT, &new, NULL);
 	logd(LOG_INFO, "%s: SIGINT triggers shutdown\n", __func__);
+
+	/* main blocked SIGUSR1 before starting any thread, so only
+	 * mmu_stats_thread receives it */
+	pthread_t thread;
+	errno = pthread_create(&thread, NULL, mmu_stats_thread, NULL);
+	if(errno) logea(__FILE__, __LINE__, NULL);
+	pthread_detach(thread);
+	logd(LOG_INFO, "%s: SIGUSR1 dumps statistics\n", __func__);
 }
 /*}}}*/
 /*}}}*/
@@ -156,12 +294,25 @@ void mmu_destroy(void)/*{{{*/
 	assert(mmu);
 	unlink(mmu->pmem_fn);
 	free(mmu->pmem_fn);
+	/* client threads tear their processes down and exit once their
+	 * sockets are shut down */
+	pthread_mutex_lock(&mmu->mutex);
 	for(int i = 3; i < MMU_MAX_SOCK; ++i) {
 		if(!mmu->sock2client[i]) continue;
 		mmu_client_destroy(mmu->sock2client[i]);
 	}
+	while(mmu->nclients > 0) pthread_cond_wait(&mmu->cond, &mmu->mutex);
+	pthread_mutex_unlock(&mmu->mutex);
+	pthread_mutex_destroy(&mmu->mutex);
+	pthread_cond_destroy(&mmu->cond);
 	munmap(mmu->pmem, mmu->npages * PAGESIZE);
-	free(mmu->disk);
+	if(mmu->disk_fd == -1) {
+		free(mmu->disk);
+	} else {
+		msync(mmu->disk, mmu->nblocks * PAGESIZE, MS_SYNC);
+		munmap(mmu->disk, mmu->nblocks * PAGESIZE);
+		close(mmu->disk_fd);
+	}
 	close(mmu->sock);
 	unlink(MMU_PROTO_UNIX_PATH);
 	free(mmu);
@@ -173,6 +324,24 @@ void mmu_shutdown_action(int signum, siginfo_t *si, void *context)/*{{{*/
 {
 	assert(si->si_signo == SIGINT);
 	mmu->running = 0;
+	/* the signal may arrive between the check of =running= and the call
+	 * to accept; shutting the socket down makes accept return anyway */
+	shutdown(mmu->sock, SHUT_RDWR);
+}
+/*}}}*/
+
+void * mmu_stats_thread(void *data)/*{{{*/
+{
+	/* statistics go to stderr to keep them out of the trace */
+	sigset_t usr1;
+	sigemptyset(&usr1);
+	sigaddset(&usr1, SIGUSR1);
+	while(1) {
+		int signum;
+		if(sigwait(&usr1, &signum)) continue;
+		stats_print(stderr);
+	}
+	return NULL;
 }
 /*}}}*/
 /*}}}*/
@@ -192,10 +361,27 @@ void mmu_accept_loop(void)/*{{{*/
 		logd(LOG_DEBUG, "%s: creating thread\n", __func__);
 		struct mmu_client *c = malloc(sizeof(*c));
 		if(!c) logea(__FILE__, __LINE__, NULL);
-		mmu->sock2client[nsock] = c;
 		c->running = 1;
 		c->sock = nsock;
 		c->pid = 0;
+		c->id = 0;
+		c->hnext = NULL;
+		pthread_mutex_init(&c->mutex, NULL);
+		pthread_cond_init(&c->work, NULL);
+		pthread_cond_init(&c->ack, NULL);
+		pthread_cond_init(&c->out, NULL);
+		c->head = c->tail = NULL;
+		c->active = 0;
+		c->out_head = c->out_tail = NULL;
+		c->sending = 0;
+		c->version = MMU_PROTO_V1;
+		frame_reader_init(&c->reader, nsock, mmu_client_msgsize);
+		c->ninval = 0;
+		c->sent = c->acked = 0;
+		pthread_mutex_lock(&mmu->mutex);
+		mmu->sock2client[nsock] = c;
+		mmu->nclients++;
+		pthread_mutex_unlock(&mmu->mutex);
 		pthread_create(&c->thread, NULL, mmu_client_thread, c);
 		pthread_detach(c->thread);
 	}
@@ -203,57 +389,219 @@ void mmu_accept_loop(void)/*{{{*/
 }/*}}}*/
 
 static void mmu_client_log(const struct mmu_client *c, const char *fname, const char *msg);
-static void mmu_client_create(struct mmu_client *c);
-static void mmu_client_extend(struct mmu_client *c);
-static void mmu_client_syslog(struct mmu_client *c);
-static void mmu_client_segv(struct mmu_client *c);
+static int mmu_client_send(struct mmu_client *c, const void *msg, size_t len);
+static int mmu_client_enqueue(struct mmu_client *c, const void *msg,
+		size_t len);
+static int mmu_client_post(struct mmu_client *c, const void *msg, size_t len,
+		uint64_t *seq);
+static int mmu_client_wait(struct mmu_client *c, uint64_t seq);
+static int mmu_client_call(struct mmu_client *c, const void *msg, size_t len);
+static void mmu_client_flush(struct mmu_client *c);
+static int mmu_client_defer(struct mmu_client *c, void *vaddr);
+static void mmu_client_inval_flush(struct mmu_client *c);
+static void mmu_batch_wait(void);
+static void mmu_client_create(struct mmu_client *c,
+		const struct mmu_proto_create2_req *req);
+static void mmu_client_extend(struct mmu_client *c,
+		const struct mmu_proto_extend_req *req);
+static void mmu_client_extendv(struct mmu_client *c,
+		const struct mmu_proto_extendv_req *req);
+static void * mmu_client_extend_run(struct mmu_client *c, uint32_t npages,
+		uint32_t *count);
+static void mmu_client_syslog(struct mmu_client *c,
+		const struct mmu_proto_syslog_req *req);
+static void mmu_client_segv(struct mmu_client *c,
+		const struct mmu_proto_segv_req *req);
+static void mmu_client_stats(struct mmu_client *c,
+		const struct mmu_proto_stats_req *req);
 static void mmu_client_exit(struct mmu_client *c);
 
 void * mmu_client_thread(void *vclient)/*{{{*/
 {
 	struct mmu_client *c = vclient;
+	for(int i = 0; i < MMU_CLIENT_WORKERS; ++i)
+		pthread_create(&c->workers[i], NULL, mmu_client_worker, c);
+	pthread_create(&c->sender, NULL, mmu_client_sender, c);
 	while(mmu->running && c->running) {
 		mmu_client_log(c, __func__, "recv");
-		uint32_t type;
-		ssize_t cnt = recv(c->sock, &type, sizeof(type), MSG_PEEK);
+		const void *msg;
+		size_t len;
+		int failed = frame_read(&c->reader, &msg, &len);
 		if(!mmu->running || !c->running) {
 			mmu_client_log(c, __func__, "breaking loop");
 			break;
 		}
-		if(cnt != sizeof(type)) goto out_client;
-		switch(type) {
+		if(failed) {
+			if(errno == EPROTO)
+				mmu_client_log(c, __func__, "invalid message");
+			goto out_client;
+		}
+		uint32_t type;
+		memcpy(&type, msg, sizeof(type));
+		if(!mmu_client_msgsize(type)) {
+			/* only framed messages get here */
+			mmu_client_log(c, __func__, "skipping unknown message");
+			continue;
+		}
+		struct mmu_request *r = malloc(sizeof(*r));
+		if(!r) logea(__FILE__, __LINE__, NULL);
+		memset(&r->msg, 0, sizeof(r->msg));
+		memcpy(&r->msg, msg, len < sizeof(r->msg) ? len : sizeof(r->msg));
+		if(type == MMU_PROTO_CREATE_REQ || type == MMU_PROTO_CREATE2_REQ) {
+			/* messages after CREATE are framed as negotiated */
+			c->reader.version = frame_negotiate(r->msg.create.version);
+		}
+		pthread_mutex_lock(&c->mutex);
+		if(type == MMU_PROTO_REMAP_REQ || type == MMU_PROTO_CHPROT_REQ) {
+			/* acknowledgements arrive in the order the messages
+			 * were sent */
+			c->acked++;
+			pthread_cond_broadcast(&c->ack);
+			free(r);
+		} else {
+			/* the client may act on its pages' protection now */
+			mmu_client_inval_flush(c);
+			r->next = NULL;
+			if(c->tail) c->tail->next = r;
+			else c->head = r;
+			c->tail = r;
+			pthread_cond_signal(&c->work);
+		}
+		pthread_mutex_unlock(&c->mutex);
+	}
+	goto out;
+
+	out_client:
+	mmu_client_destroy(c);
+
+	out:
+	pthread_mutex_lock(&c->mutex);
+	c->running = 0;
+	pthread_cond_broadcast(&c->work);
+	pthread_cond_broadcast(&c->ack);
+	pthread_cond_broadcast(&c->out);
+	pthread_mutex_unlock(&c->mutex);
+	for(int i = 0; i < MMU_CLIENT_WORKERS; ++i)
+		pthread_join(c->workers[i], NULL);
+	if(c->pid) { /* may get here before CREATE_REQ happens */
+		pager_destroy(c->pid);
+	}
+	pthread_join(c->sender, NULL);
+	while(c->head) {
+		struct mmu_request *r = c->head;
+		c->head = r->next;
+		free(r);
+	}
+	while(c->out_head) {
+		struct mmu_outbound *o = c->out_head;
+		c->out_head = o->next;
+		free(o);
+	}
+	mmu_client_log(c, __func__, "finished");
+	pthread_mutex_lock(&mmu->mutex);
+	if(c->pid) mmu_client_unhash(c);
+	mmu->sock2client[c->sock] = NULL;
+	close(c->sock);
+	mmu->nclients--;
+	pthread_cond_broadcast(&mmu->cond);
+	pthread_mutex_unlock(&mmu->mutex);
+	pthread_mutex_destroy(&c->mutex);
+	pthread_cond_destroy(&c->work);
+	pthread_cond_destroy(&c->ack);
+	pthread_cond_destroy(&c->out);
+	free(c);
+	pthread_exit(NULL);
+}/*}}}*/
+
+void * mmu_client_worker(void *vclient)/*{{{*/
+{
+	struct mmu_client *c = vclient;
+	pthread_mutex_lock(&c->mutex);
+	while(c->running) {
+		struct mmu_request *r = c->head;
+		if(!r) {
+			pthread_cond_wait(&c->work, &c->mutex);
+			continue;
+		}
+		c->head = r->next;
+		if(!c->head) c->tail = NULL;
+		if(r->msg.type == MMU_PROTO_EXIT_REQ) {
+			/* let requests from other threads finish first */
+			while(c->running && c->active > 0)
+				pthread_cond_wait(&c->work, &c->mutex);
+		}
+		c->active++;
+		pthread_mutex_unlock(&c->mutex);
+		uint64_t start = stats_now();
+		int hist = -1;
+		switch(r->msg.type) {
 		case MMU_PROTO_CREATE_REQ:
-			mmu_client_create(c);
+		case MMU_PROTO_CREATE2_REQ:
+			mmu_client_create(c, &r->msg.create);
+			hist = STATS_CREATE;
 			break;
 		case MMU_PROTO_EXTEND_REQ:
-			mmu_client_extend(c);
+			mmu_client_extend(c, &r->msg.extend);
+			hist = STATS_EXTEND;
+			break;
+		case MMU_PROTO_EXTENDV_REQ:
+			mmu_client_extendv(c, &r->msg.extendv);
+			hist = STATS_EXTEND;
 			break;
 		case MMU_PROTO_SYSLOG_REQ:
-			mmu_client_syslog(c);
+			mmu_client_syslog(c, &r->msg.syslog);
+			hist = STATS_SYSLOG;
 			break;
 		case MMU_PROTO_SEGV_REQ:
-			mmu_client_segv(c);
+			mmu_client_segv(c, &r->msg.segv);
+			hist = STATS_SEGV;
 			break;
-		case MMU_PROTO_REMAP_REQ:
-		case MMU_PROTO_CHPROT_REQ:
-			/* these messages are handled by the pager thread */
+		case MMU_PROTO_STATS_REQ:
+			mmu_client_stats(c, &r->msg.stats);
 			break;
 		case MMU_PROTO_EXIT_REQ:
 			mmu_client_exit(c);
-			break;
-		default:
-			mmu_client_log(c, __func__, "invalid message type");
-			goto out_client;
+			hist = STATS_EXIT;
 			break;
 		}
+		if(hist != -1) stats_record(hist, stats_now() - start);
+		free(r);
+		pthread_mutex_lock(&c->mutex);
+		c->active--;
+		pthread_cond_broadcast(&c->work);
 	}
-	mmu_client_log(c, __func__, "finished");
-	free(c);
-	pthread_exit(NULL);
+	pthread_mutex_unlock(&c->mutex);
+	return NULL;
+}/*}}}*/
 
-	out_client:
-	mmu_client_destroy(c);
-	pthread_exit(NULL);
+void * mmu_client_sender(void *vclient)/*{{{*/
+{
+	struct mmu_client *c = vclient;
+	pthread_mutex_lock(&c->mutex);
+	while(c->running) {
+		struct mmu_outbound *o = c->out_head;
+		if(!o) {
+			pthread_cond_wait(&c->out, &c->mutex);
+			continue;
+		}
+		c->out_head = o->next;
+		if(!c->out_head) c->out_tail = NULL;
+		c->sending = 1;
+		pthread_mutex_unlock(&c->mutex);
+		ssize_t cnt = send(c->sock, o->msg, o->len, MSG_NOSIGNAL);
+		int failed = cnt != (ssize_t)o->len;
+		free(o);
+		pthread_mutex_lock(&c->mutex);
+		c->sending = 0;
+		pthread_cond_broadcast(&c->out);
+		if(failed) {
+			pthread_mutex_unlock(&c->mutex);
+			mmu_client_destroy(c);
+			pthread_mutex_lock(&c->mutex);
+		}
+	}
+	pthread_mutex_unlock(&c->mutex);
+	return NULL;
 }/*}}}*/
 
 void mmu_client_log(const struct mmu_client *c, const char *fname, const char *msg)/*{{{*/
@@ -262,290 +610,566 @@ void mmu_client_log(const struct mmu_client *c, const char *fname, const char *m
 			(int)c->pid, msg);
 }/*}}}*/
 
-void mmu_client_create(struct mmu_client *c)/*{{{*/
+size_t mmu_client_msgsize(uint32_t type)/*{{{*/
+{
+	switch(type) {
+	case MMU_PROTO_CREATE_REQ:
+		return sizeof(struct mmu_proto_create_req);
+	case MMU_PROTO_CREATE2_REQ:
+		return sizeof(struct mmu_proto_create2_req);
+	case MMU_PROTO_EXTEND_REQ:
+		return sizeof(struct mmu_proto_extend_req);
+	case MMU_PROTO_EXTENDV_REQ:
+		return sizeof(struct mmu_proto_extendv_req);
+	case MMU_PROTO_SYSLOG_REQ:
+		return sizeof(struct mmu_proto_syslog_req);
+	case MMU_PROTO_SEGV_REQ:
+		return sizeof(struct mmu_proto_segv_req);
+	case MMU_PROTO_STATS_REQ:
+		return sizeof(struct mmu_proto_stats_req);
+	case MMU_PROTO_REMAP_REQ:
+		return sizeof(struct mmu_proto_remap_req);
+	case MMU_PROTO_CHPROT_REQ:
+		return sizeof(struct mmu_proto_chprot_req);
+	case MMU_PROTO_EXIT_REQ:
+		return sizeof(struct mmu_proto_exit_req);
+	}
+	return 0;
+}/*}}}*/
+
+int mmu_client_enqueue(struct mmu_client *c, const void *msg, size_t len)/*{{{*/
+{
+	/* call with =c->mutex= locked */
+	if(!c->running) return -1;
+	struct mmu_outbound *o = malloc(sizeof(*o) + len
+			+ sizeof(struct mmu_proto_frame));
+	if(!o) logea(__FILE__, __LINE__, NULL);
+	o->next = NULL;
+	o->len = frame_encode(c->version, o->msg, msg, len);
+	if(c->out_tail) c->out_tail->next = o;
+	else c->out_head = o;
+	c->out_tail = o;
+	pthread_cond_broadcast(&c->out);
+	return 0;
+}/*}}}*/
+
+int mmu_client_send(struct mmu_client *c, const void *msg, size_t len)/*{{{*/
+{
+	pthread_mutex_lock(&c->mutex);
+	int ret = mmu_client_enqueue(c, msg, len);
+	pthread_mutex_unlock(&c->mutex);
+	return ret;
+}/*}}}*/
+
+int mmu_client_post(struct mmu_client *c, const void *msg, size_t len,/*{{{*/
+		uint64_t *seq)
+{
+	pthread_mutex_lock(&c->mutex);
+	/* deferred changes go first so later ones override them */
+	mmu_client_inval_flush(c);
+	int ret = mmu_client_enqueue(c, msg, len);
+	*seq = ++c->sent;
+	pthread_mutex_unlock(&c->mutex);
+	return ret;
+}/*}}}*/
+
+int mmu_client_wait(struct mmu_client *c, uint64_t seq)/*{{{*/
+{
+	/* The client thread counts acknowledgements, which arrive in the
+	 * order messages were sent. */
+	pthread_mutex_lock(&c->mutex);
+	while(c->running && c->acked < seq)
+		pthread_cond_wait(&c->ack, &c->mutex);
+	int ret = c->acked < seq ? -1 : 0;
+	pthread_mutex_unlock(&c->mutex);
+	return ret;
+}/*}}}*/
+
+int mmu_client_call(struct mmu_client *c, const void *msg, size_t len)/*{{{*/
+{
+	/* We need mmu_remap and mmu_chprot to wait for the application
+	 * to effect the protection change before we return to the
+	 * pager, or before =mmu_batch_end= returns inside a batch. */
+	uint64_t seq;
+	if(mmu_client_post(c, msg, len, &seq)) return -1;
+	if(!batch.depth) return mmu_client_wait(c, seq);
+	int i = 0;
+	while(i < batch.n && batch.clients[i] != c) i++;
+	if(i == MMU_BATCH_MAX) {
+		mmu_batch_wait();
+		i = 0;
+	}
+	if(i == batch.n) batch.clients[batch.n++] = c;
+	batch.seqs[i] = seq;
+	return 0;
+}/*}}}*/
+
+void mmu_client_flush(struct mmu_client *c)/*{{{*/
+{
+	pthread_mutex_lock(&c->mutex);
+	while(c->running && (c->out_head || c->sending))
+		pthread_cond_wait(&c->out, &c->mutex);
+	pthread_mutex_unlock(&c->mutex);
+}/*}}}*/
+
+int mmu_client_defer(struct mmu_client *c, void *vaddr)/*{{{*/
+{
+	/* A client with no request in progress is not waiting on the
+	 * MMU, so taking access away from one of its pages can wait
+	 * until it next talks to the MMU.  The page then looks
+	 * unreferenced to the pager, which is why only PROT_NONE changes
+	 * are deferred: mappings themselves are always changed
+	 * synchronously. */
+	if(!mmu->lazy) return 0;
+	pthread_mutex_lock(&c->mutex);
+	int idle = c->running && !c->active && !c->head
+			&& c->ninval < MMU_INVAL_MAX;
+	if(idle) {
+		int i = 0;
+		while(i < c->ninval && c->inval[i] != (intptr_t)vaddr) i++;
+		if(i == c->ninval) c->inval[c->ninval++] = (intptr_t)vaddr;
+	}
+	pthread_mutex_unlock(&c->mutex);
+	return idle;
+}/*}}}*/
+
+void mmu_client_inval_flush(struct mmu_client *c)/*{{{*/
+{
+	/* call with =c->mutex= locked; nobody waits for these
+	 * acknowledgements, but they keep =acked= in step with =sent= */
+	for(int i = 0; i < c->ninval; ++i) {
+		struct mmu_proto_chprot_rep rep;
+		rep.type = MMU_PROTO_CHPROT_REP;
+		rep.prot = PROT_NONE;
+		rep.vaddr = c->inval[i];
+		if(mmu_client_enqueue(c, &rep, sizeof(rep))) break;
+		c->sent++;
+	}
+	c->ninval = 0;
+}/*}}}*/
+
+void mmu_batch_wait(void)/*{{{*/
+{
+	for(int i = 0; i < batch.n; ++i) {
+		if(mmu_client_wait(batch.clients[i], batch.seqs[i]))
+			mmu_client_destroy(batch.clients[i]);
+	}
+	batch.n = 0;
+}/*}}}*/
+
+void mmu_client_create(struct mmu_client *c,/*{{{*/
+		const struct mmu_proto_create2_req *req)
 {
 	char msg[96];
-	struct mmu_proto_create_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
-	assert(req.type == MMU_PROTO_CREATE_REQ);
-
-	c->pid = (pid_t)req.pid;
-	int id = nextid;
-	id2pid[nextid++] = c->pid;
-	printf("pager_create pid %d\n", id);
+	pthread_mutex_lock(&mmu->mutex);
+	c->pid = (pid_t)req->pid;
+	c->id = mmu->nextid++;
+	struct mmu_client **bucket = mmu_client_bucket(c->pid);
+	c->hnext = *bucket;
+	*bucket = c;
+	pthread_mutex_unlock(&mmu->mutex);
+	uint32_t id = c->id;
+	struct trace_event ev = {.op = TRACE_CREATE, .id = id};
+	trace_emit(&ev, NULL, 0);
 	pager_create(c->pid);
-	snprintf(msg, 96, "create pid %d", id);
+	snprintf(msg, 96, "create pid %u", id);
 	mmu_client_log(c, __func__, msg);
 
-	struct mmu_proto_create_rep rep;
-	rep.type = MMU_PROTO_CREATE_REP;
+	/* a CREATE_REP is a CREATE2_REP without the trailing =version= */
+	struct mmu_proto_create2_rep rep;
+	size_t len = sizeof(rep);
+	rep.type = MMU_PROTO_CREATE2_REP;
+	if(req->type == MMU_PROTO_CREATE_REQ) {
+		len = sizeof(struct mmu_proto_create_rep);
+		rep.type = MMU_PROTO_CREATE_REP;
+	}
+	rep.npages = 0;
+	char token[MMU_PROTO_TOKEN_MAX];
+	memcpy(token, req->token, MMU_PROTO_TOKEN_MAX);
+	token[MMU_PROTO_TOKEN_MAX-1] = '\0';
+	if(token[0] != '\0') {
+		rep.npages = pager_attach(c->pid, token);
+		struct trace_event ev = {.op = TRACE_ATTACH, .id = id,
+				.npages = (int32_t)rep.npages};
+		trace_emit(&ev, NULL, 0);
+	}
 	memset(rep.pmem_fn, '\0', MMU_PROTO_PATH_MAX);
 	strncat(rep.pmem_fn, mmu->pmem_fn, MMU_PROTO_PATH_MAX-1);
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		goto out_client;
-	return;
-
-	out_client:
-	mmu_client_destroy(c);
+	rep.version = frame_negotiate(req->version);
+	pthread_mutex_lock(&c->mutex);
+	int failed = mmu_client_enqueue(c, &rep, len);
+	/* the reply itself is not framed, but everything after it is */
+	c->version = rep.version;
+	pthread_mutex_unlock(&c->mutex);
+	if(failed) mmu_client_destroy(c);
 }/*}}}*/
 
-void mmu_client_extend(struct mmu_client *c)/*{{{*/
+void mmu_client_extend(struct mmu_client *c,/*{{{*/
+		const struct mmu_proto_extend_req *req)
 {
-	char msg[96];
-	struct mmu_proto_extend_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
-	assert(req.type == MMU_PROTO_EXTEND_REQ);
-
-	int id = get_pid_id(c->pid);
-	void *vaddr = pager_extend(c->pid);
-	printf("pager_extend pid %d vaddr %p\n", id, vaddr);
-	snprintf(msg, 96, "extend vaddr %p", vaddr);
-	mmu_client_log(c, __func__, msg);
-
 	struct mmu_proto_extend_rep rep;
 	rep.type = MMU_PROTO_EXTEND_REP;
-	rep.vaddr = (intptr_t)vaddr;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		goto out_client;
-	return;
+	rep.reqid = req->reqid;
+	uint32_t count;
+	rep.vaddr = (intptr_t)mmu_client_extend_run(c, req->npages, &count);
+	rep.npages = count;
+	if(mmu_client_send(c, &rep, sizeof(rep)))
+		mmu_client_destroy(c);
+}/*}}}*/
 
-	out_client:
-	mmu_client_destroy(c);
+void mmu_client_extendv(struct mmu_client *c,/*{{{*/
+		const struct mmu_proto_extendv_req *req)
+{
+	struct mmu_proto_extendv_rep rep;
+	memset(&rep, 0, sizeof(rep));
+	rep.type = MMU_PROTO_EXTENDV_REP;
+	rep.reqid = req->reqid;
+	rep.count = req->count;
+	if(rep.count > MMU_PROTO_EXTENDV_MAX) rep.count = MMU_PROTO_EXTENDV_MAX;
+	for(uint32_t i = 0; i < rep.count; ++i) {
+		uint32_t count;
+		rep.vaddr[i] = (intptr_t)mmu_client_extend_run(c,
+				req->npages[i], &count);
+		rep.npages[i] = count;
+	}
+	if(mmu_client_send(c, &rep, sizeof(rep)))
+		mmu_client_destroy(c);
 }/*}}}*/
 
-void mmu_client_syslog(struct mmu_client *c)/*{{{*/
+void * mmu_client_extend_run(struct mmu_client *c, uint32_t npages,/*{{{*/
+		uint32_t *count)
 {
 	char msg[96];
-	struct mmu_proto_syslog_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
-	assert(req.type == MMU_PROTO_SYSLOG_REQ);
-
-	assert(req.addr < UINTPTR_MAX);
-	void *vaddr = (void *)(uintptr_t)req.addr;
-	size_t len = (size_t)req.len;
-	int id = get_pid_id(c->pid);
-	printf("pager_syslog pid %d %p\n", id, vaddr);
+	uint32_t id = c->id;
+	int n = npages > INT32_MAX ? INT32_MAX : (int)npages;
+	void *vaddr = pager_extend_run(c->pid, n, &n);
+	/* one line per page keeps the trace of single-page extends */
+	struct trace_event ev = {.op = TRACE_EXTEND, .id = id,
+			.vaddr = (uintptr_t)vaddr};
+	trace_emit(&ev, NULL, 0);
+	for(int i = 1; i < n; ++i) {
+		ev.vaddr = (uintptr_t)vaddr + i*PAGESIZE;
+		trace_emit(&ev, NULL, 0);
+	}
+	snprintf(msg, 96, "extend vaddr %p npages %d", vaddr, n);
+	mmu_client_log(c, __func__, msg);
+	*count = (uint32_t)n;
+	return vaddr;
+}/*}}}*/
+
+void mmu_client_syslog(struct mmu_client *c,/*{{{*/
+		const struct mmu_proto_syslog_req *req)
+{
+	char msg[96];
+	assert(req->addr < UINTPTR_MAX);
+	void *vaddr = (void *)(uintptr_t)req->addr;
+	size_t len = (size_t)req->len;
+	uint32_t id = c->id;
+	struct trace_event ev = {.op = TRACE_SYSLOG, .id = id,
+			.vaddr = (uintptr_t)vaddr};
+	trace_emit(&ev, NULL, 0);
 	int status = pager_syslog(c->pid, vaddr, len);
+	if(status) status = -errno;
 	snprintf(msg, 96, "vaddr %p len %zu retcode %d", vaddr, len, status);
 	mmu_client_log(c, __func__, msg);
 
 	struct mmu_proto_syslog_rep rep;
 	rep.type = MMU_PROTO_SYSLOG_REP;
+	rep.reqid = req->reqid;
 	rep.retcode = (uint32_t)status;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		goto out_client;
-	return;
-
-	out_client:
-	mmu_client_destroy(c);
+	if(mmu_client_send(c, &rep, sizeof(rep)))
+		mmu_client_destroy(c);
 }/*}}}*/
 
-void mmu_client_segv(struct mmu_client *c)/*{{{*/
+void mmu_client_segv(struct mmu_client *c,/*{{{*/
+		const struct mmu_proto_segv_req *req)
 {
 	char msg[96];
-	struct mmu_proto_segv_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
-	assert(req.type == MMU_PROTO_SEGV_REQ);
-
-	assert(req.addr < UINTPTR_MAX);
-	void *vaddr = (void *)(uintptr_t)req.addr;
-	int code = (int)req.code;
+	assert(req->addr < UINTPTR_MAX);
+	void *vaddr = (void *)(uintptr_t)req->addr;
+	int code = (int)req->code;
 	snprintf(msg, 96, "vaddr %p code %d", vaddr, code);
 	mmu_client_log(c, __func__, msg);
 
-	int id = get_pid_id(c->pid);
-	printf("pager_fault pid %d vaddr %p\n", id, vaddr);
-	pager_fault(c->pid, vaddr);
+	uint32_t id = c->id;
+	struct trace_event ev = {.op = TRACE_FAULT, .id = id,
+			.vaddr = (uintptr_t)vaddr};
+	trace_emit(&ev, NULL, 0);
+	int status = pager_fault(c->pid, vaddr);
+	if(status) {
+		status = -errno;
+		logd(LOG_WARN, "%s pid %u vaddr %p: out of memory\n", __func__,
+				id, vaddr);
+	}
 
 	struct mmu_proto_segv_rep rep;
 	rep.type = MMU_PROTO_SEGV_REP;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		goto out_client;
-	return;
+	rep.reqid = req->reqid;
+	rep.retcode = status;
+	if(mmu_client_send(c, &rep, sizeof(rep)))
+		mmu_client_destroy(c);
+}/*}}}*/
 
-	out_client:
-	mmu_client_destroy(c);
+void mmu_client_stats(struct mmu_client *c,/*{{{*/
+		const struct mmu_proto_stats_req *req)
+{
+	struct stats *s = malloc(sizeof(*s));
+	if(!s) logea(__FILE__, __LINE__, NULL);
+	stats_read(s);
+	struct mmu_proto_stats_rep rep;
+	rep.type = MMU_PROTO_STATS_REP;
+	rep.reqid = req->reqid;
+	for(int i = 0; i < MMU_PROTO_STATS_COUNTERS; ++i)
+		rep.counters[i] = s->counters[i];
+	for(int i = 0; i < MMU_PROTO_STATS_HISTS; ++i) {
+		const struct stats_hist *h = &s->hists[i];
+		rep.count[i] = h->count;
+		rep.mean[i] = h->count ? h->sum / h->count : 0;
+		rep.p50[i] = stats_percentile(h, 50);
+		rep.p99[i] = stats_percentile(h, 99);
+		rep.max[i] = h->max;
+	}
+	free(s);
+	if(mmu_client_send(c, &rep, sizeof(rep)))
+		mmu_client_destroy(c);
 }/*}}}*/
 
 void mmu_client_exit(struct mmu_client *c)/*{{{*/
 {
-	struct mmu_proto_exit_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
 	mmu_client_log(c, __func__, "exiting cleanly");
-	assert(req.type == MMU_PROTO_EXIT_REQ);
 	assert(c->pid);
-	int id = get_pid_id(c->pid);
-	printf("pager_destroy pid %d\n", id);
+	uint32_t id = c->id;
+	struct trace_event ev = {.op = TRACE_DESTROY, .id = id};
+	trace_emit(&ev, NULL, 0);
 	pager_destroy(c->pid);
+	pthread_mutex_lock(&mmu->mutex);
+	mmu_client_unhash(c);
+	pthread_mutex_unlock(&mmu->mutex);
 
-	struct mmu_proto_segv_rep rep;
+	struct mmu_proto_exit_rep rep;
 	rep.type = MMU_PROTO_EXIT_REP;
-	send(c->sock, &rep, sizeof(rep), 0); /* ignoring return value */
+	mmu_client_send(c, &rep, sizeof(rep)); /* ignoring return value */
+	mmu_client_flush(c);
 
-	mmu->sock2client[c->sock] = NULL;
+	/* the client thread sees the socket shut down and finishes */
+	pthread_mutex_lock(&c->mutex);
+	c->pid = 0;
 	c->running = 0;
-	close(c->sock);
-	return;
-
-	out_client:
-	mmu_client_destroy(c);
+	shutdown(c->sock, SHUT_RDWR);
+	pthread_cond_broadcast(&c->work);
+	pthread_cond_broadcast(&c->ack);
+	pthread_cond_broadcast(&c->out);
+	pthread_mutex_unlock(&c->mutex);
 }/*}}}*/
 
 void mmu_client_destroy(struct mmu_client *c)/*{{{*/
 {
+	/* Only wakes up the client's threads; the client thread
+	 * destroys the process and frees =c= once the workers finish,
+	 * so this is safe to call while in the pager. */
 	loge(LOG_WARN, __FILE__, __LINE__);
 	mmu_client_log(c, __func__, "running");
-	mmu->sock2client[c->sock] = NULL;
+	pthread_mutex_lock(&c->mutex);
 	c->running = 0;
-	close(c->sock);
-	if(c->pid) { /* may get here before CREATE_REQ happens */
-		pager_destroy(c->pid);
-	}
+	shutdown(c->sock, SHUT_RDWR);
+	pthread_cond_broadcast(&c->work);
+	pthread_cond_broadcast(&c->ack);
+	pthread_cond_broadcast(&c->out);
+	pthread_mutex_unlock(&c->mutex);
 }/*}}}*/
 /*}}}*/
 
 /****************************************************************************
  * external functions {{{
  ***************************************************************************/
+struct mmu_client ** mmu_client_bucket(pid_t pid)/*{{{*/
+{
+	/* Fibonacci hashing spreads consecutive pids over the chains */
+	uint32_t h = (uint32_t)pid * 2654435761u;
+	return &mmu->pid2client[h >> (32 - MMU_PID_BITS)];
+}/*}}}*/
+
+void mmu_client_unhash(struct mmu_client *c)/*{{{*/
+{
+	struct mmu_client **link = mmu_client_bucket(c->pid);
+	while(*link && *link != c) link = &(*link)->hnext;
+	if(*link) *link = c->hnext;
+	c->hnext = NULL;
+}/*}}}*/
+
 struct mmu_client * mmu_client_search(pid_t pid)/*{{{*/
 {
-	for(int i = 3; i < MMU_MAX_SOCK; ++i) {
-		if(!mmu->sock2client[i]) continue;
-		if(mmu->sock2client[i]->pid == pid) return mmu->sock2client[i];
-	}
+	pthread_mutex_lock(&mmu->mutex);
+	struct mmu_client *c = *mmu_client_bucket(pid);
+	while(c && c->pid != pid) c = c->hnext;
+	pthread_mutex_unlock(&mmu->mutex);
+	if(c) return c;
 	printf("error: pid %d not found.  aborting.\n", (int)pid);
 	logd(LOG_FATAL, "pid %d not found.  aborting.\n", (int)pid);
-	mmu_destroy();
+	/* mmu_destroy would wait for the calling client thread */
+	unlink(mmu->pmem_fn);
+	unlink(MMU_PROTO_UNIX_PATH);
 	exit(EXIT_FAILURE);
 }/*}}}*/
 
+void mmu_batch_begin(void)/*{{{*/
+{
+	batch.depth++;
+}/*}}}*/
+
+void mmu_batch_end(void)/*{{{*/
+{
+	assert(batch.depth > 0);
+	if(--batch.depth == 0) mmu_batch_wait();
+}/*}}}*/
+
 void mmu_zero_fill(int frame)/*{{{*/
 {
-	printf("%s frame %u\n", __func__, frame);
+	struct trace_event ev = {.op = TRACE_ZERO_FILL, .frame = frame};
+	trace_emit(&ev, NULL, 0);
 	logd(LOG_DEBUG, "%s frame %u\n", __func__, frame);
 	memset(mmu->pmem + (PAGESIZE*frame), '0', PAGESIZE);
 }/*}}}*/
 
+static void mmu_remap(struct mmu_client *c, void *vaddr, int frame, int npages,
+		int prot);
+
 void mmu_resident(pid_t pid, void *vaddr, int frame, int prot)/*{{{*/
 {
-	int id = get_pid_id(pid);
-	printf("%s pid %d vaddr %p prot %d frame %u\n", __func__,
-			id, vaddr, prot, frame);
-	logd(LOG_DEBUG, "%s pid %d vaddr %p prot %d frame %u\n", __func__,
-			id, vaddr, prot, frame);
 	struct mmu_client *c = mmu_client_search(pid);
+	struct trace_event ev = {.op = TRACE_RESIDENT, .id = c->id,
+			.vaddr = (uintptr_t)vaddr, .prot = prot, .frame = frame};
+	trace_emit(&ev, NULL, 0);
+	logd(LOG_DEBUG, "%s pid %u vaddr %p prot %d frame %u\n", __func__,
+			c->id, vaddr, prot, frame);
+	mmu_remap(c, vaddr, frame, 1, prot);
+}/*}}}*/
+
+void mmu_resident_run(pid_t pid, void *vaddr, int frame, int npages,/*{{{*/
+		int prot)
+{
+	struct mmu_client *c = mmu_client_search(pid);
+	struct trace_event ev = {.op = TRACE_RESIDENT_RUN, .id = c->id,
+			.vaddr = (uintptr_t)vaddr, .npages = npages, .prot = prot,
+			.frame = frame};
+	trace_emit(&ev, NULL, 0);
+	logd(LOG_DEBUG, "%s pid %u vaddr %p npages %d prot %d frame %u\n",
+			__func__, c->id, vaddr, npages, prot, frame);
+	mmu_remap(c, vaddr, frame, npages, prot);
+}/*}}}*/
+
+void mmu_remap(struct mmu_client *c, void *vaddr, int frame, int npages,/*{{{*/
+		int prot)
+{
 	struct mmu_proto_remap_rep rep;
 	rep.type = MMU_PROTO_REMAP_REP;
 	rep.prot = (int32_t)prot;
 	rep.offset = (uint64_t)(PAGESIZE * frame);
 	rep.vaddr = (intptr_t)vaddr;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		goto out_client;
-
-	/* We need these functions to wait for the application to
-	 * effect the protection change before we return to the
-	 * pager.  This loop is necessary because mmu_client_thread
-	 * is already in the pager and blocked here (so we cannot
-	 * wait on a condition variable to be signaled forward as
-	 * there is no one else to recv the REMAP_REQ message).  An
-	 * alternative approach would be to use two sockets or
-	 * threads. */
-	uint32_t t;
-	do {
-		 if(recv(c->sock, &t, sizeof(t), MSG_PEEK) != sizeof(t))
-			goto out_client;
-	} while(t != MMU_PROTO_REMAP_REQ);
-	struct mmu_proto_remap_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
-	assert(req.type == MMU_PROTO_REMAP_REQ);
-	return;
-
-	out_client:
-	mmu_client_destroy(c);
+	rep.npages = (uint32_t)npages;
+	if(mmu_client_call(c, &rep, sizeof(rep)))
+		mmu_client_destroy(c);
 }/*}}}*/
 
 
 void mmu_nonresident(pid_t pid, void *vaddr)/*{{{*/
 {
-	int id = get_pid_id(pid);
-	printf("%s pid %d vaddr %p\n", __func__, id, vaddr);
-	logd(LOG_DEBUG, "%s pid %d vaddr %p\n", __func__, id, vaddr);
 	struct mmu_client *c = mmu_client_search(pid);
+	struct trace_event ev = {.op = TRACE_NONRESIDENT, .id = c->id,
+			.vaddr = (uintptr_t)vaddr};
+	trace_emit(&ev, NULL, 0);
+	logd(LOG_DEBUG, "%s pid %u vaddr %p\n", __func__, c->id, vaddr);
 	struct mmu_proto_chprot_rep rep;
 	rep.type = MMU_PROTO_CHPROT_REP;
 	rep.prot = PROT_NONE;
 	rep.vaddr = (intptr_t)vaddr;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		goto out_client;
-
-	uint32_t t;
-	do {
-		if(recv(c->sock, &t, sizeof(t), MSG_PEEK) != sizeof(t))
-			goto out_client;
-	} while(t != MMU_PROTO_CHPROT_REQ);
-	struct mmu_proto_chprot_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
-	assert(req.type == MMU_PROTO_CHPROT_REQ);
-	return;
-
-	out_client:
-	mmu_client_destroy(c);
+	if(mmu_client_call(c, &rep, sizeof(rep)))
+		mmu_client_destroy(c);
 }/*}}}*/
 
 void mmu_chprot(pid_t pid, void *vaddr, int prot)/*{{{*/
 {
-	int id = get_pid_id(pid);
-	printf("%s pid %d vaddr %p prot %d\n", __func__, id, vaddr, prot);
-	logd(LOG_DEBUG, "%s pid %d vaddr %p prot %d\n", __func__,
-			id, vaddr,prot);
 	struct mmu_client *c = mmu_client_search(pid);
+	struct trace_event ev = {.op = TRACE_CHPROT, .id = c->id,
+			.vaddr = (uintptr_t)vaddr, .prot = prot};
+	trace_emit(&ev, NULL, 0);
+	logd(LOG_DEBUG, "%s pid %u vaddr %p prot %d\n", __func__,
+			c->id, vaddr, prot);
+	if(prot == PROT_NONE && mmu_client_defer(c, vaddr)) return;
 	struct mmu_proto_chprot_rep rep;
 	rep.type = MMU_PROTO_CHPROT_REP;
 	rep.prot = (int32_t)prot;
 	rep.vaddr = (intptr_t)vaddr;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		goto out_client;
-
-	uint32_t t;
-	do {
-		if(recv(c->sock, &t, sizeof(t), MSG_PEEK) != sizeof(t))
-			goto out_client;
-	} while(t != MMU_PROTO_CHPROT_REQ);
-	struct mmu_proto_chprot_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
-	assert(req.type == MMU_PROTO_CHPROT_REQ);
-	return;
+	if(mmu_client_call(c, &rep, sizeof(rep)))
+		mmu_client_destroy(c);
+}/*}}}*/
 
-	out_client:
-	mmu_client_destroy(c);
+int mmu_chprot_pending(pid_t pid, void *vaddr)/*{{{*/
+{
+	if(!mmu->lazy) return 0;
+	struct mmu_client *c = mmu_client_search(pid);
+	pthread_mutex_lock(&c->mutex);
+	int i = 0;
+	while(i < c->ninval && c->inval[i] != (intptr_t)vaddr) i++;
+	int pending = i < c->ninval;
+	pthread_mutex_unlock(&c->mutex);
+	return pending;
 }/*}}}*/
 
 void mmu_disk_read(int block_from, int frame_to)/*{{{*/
 {
-	printf("%s from block %d to frame %d\n", __func__,
-			block_from, frame_to);
+	struct trace_event ev = {.op = TRACE_DISK_READ, .block = block_from,
+			.frame = frame_to};
+	trace_emit(&ev, NULL, 0);
 	logd(LOG_DEBUG, "%s from block %d to frame %d\n", __func__,
 			block_from, frame_to);
 	memcpy(mmu->pmem + frame_to*PAGESIZE, mmu->disk + block_from*PAGESIZE,
 			PAGESIZE);
+	stats_add(STATS_DISK_READ, 1);
 }/*}}}*/
 
 void mmu_disk_write(int frame_from, int block_to)/*{{{*/
 {
-	printf("%s from frame %d to block %d\n", __func__,
-			frame_from, block_to);
+	struct trace_event ev = {.op = TRACE_DISK_WRITE, .frame = frame_from,
+			.block = block_to};
+	trace_emit(&ev, NULL, 0);
 	logd(LOG_DEBUG, "%s from frame %d to block %d\n", __func__,
 			frame_from, block_to);
 	memcpy(mmu->disk + block_to*PAGESIZE, mmu->pmem + frame_from*PAGESIZE,
 			PAGESIZE);
+	stats_add(STATS_WRITEBACK, 1);
+}/*}}}*/
+
+void mmu_disk_writev(const int *frames_from, int n, int block_to)/*{{{*/
+{
+	/* the trace lists the frames */
+	int32_t frames[n];
+	for(int i = 0; i < n; ++i) frames[i] = frames_from[i];
+	struct trace_event ev = {.op = TRACE_DISK_WRITEV, .npages = n,
+			.block = block_to};
+	trace_emit(&ev, frames, n * sizeof(frames[0]));
+	logd(LOG_DEBUG, "%s %d frames to block %d\n", __func__, n, block_to);
+	for(int i = 0; i < n; ++i) {
+		memcpy(mmu->disk + (block_to+i)*PAGESIZE,
+				mmu->pmem + frames_from[i]*PAGESIZE, PAGESIZE);
+	}
+	stats_add(STATS_WRITEBACK, n);
+}/*}}}*/
+
+void mmu_disk_move(int block_from, int block_to)/*{{{*/
+{
+	struct trace_event ev = {.op = TRACE_DISK_MOVE, .block = block_from,
+			.frame = block_to};
+	trace_emit(&ev, NULL, 0);
+	logd(LOG_DEBUG, "%s from block %d to block %d\n", __func__,
+			block_from, block_to);
+	memcpy(mmu->disk + block_to*PAGESIZE, mmu->disk + block_from*PAGESIZE,
+			PAGESIZE);
+}/*}}}*/
+
+const char *mmu_disk_block(int block)/*{{{*/
+{
+	return mmu->disk + block*PAGESIZE;
 }/*}}}*/
 /*}}}*/
 
@@ -569,17 +1193,31 @@ int main(int argc, char **argv) {/*{{{*/
 	if(npages < 1 || npages > 256) usage(argc, argv);
 	int nblocks = atoi(argv[2]);
 	if(nblocks < 2 || nblocks > 1024) usage(argc, argv);
+	/* every thread inherits the mask, the log and trace writers too */
+	sigset_t usr1;
+	sigemptyset(&usr1);
+	sigaddset(&usr1, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &usr1, NULL);
 	#ifdef MMULOG
 	log_init(LOG_EXTRA, "mmu.log", 1, 1<<20);
+	const char *async = getenv("MMU_LOG_ASYNC");
+	if(async) log_async(LOG_ASYNC_FLUSHSIZE, atoi(async));
 	#endif
-	memset(id2pid, 255, UINT8_MAX * sizeof(pid_t));
+	const char *trace = getenv("MMU_TRACE");
+	if(trace_init(trace ? trace : "text")) {
+		perror("MMU_TRACE");
+		exit(EXIT_FAILURE);
+	}
 	mmu_init(npages, nblocks);
 	pager_init(npages, nblocks);
+	mmu_notify_ready();
 	mmu_accept_loop();
+	mmu_destroy();
+	pager_save();
+	trace_destroy();
 	#ifdef MMUFREE
 	pager_free();
 	#endif
-	mmu_destroy();
 	#ifdef MMULOG
 	log_destroy();
 	#endif
@@ -25,7 +25,18 @@ extern const char *pmem;
 
 /* All functions in this module are blocking, i.e., they only return after
  * changes to physical memory, disk, and program virtual addresses are
- * complete.  */
+ * complete, except inside a batch (see `mmu_batch_begin`).  */
+
+/* `mmu_batch_begin` and `mmu_batch_end` bracket calls made by the
+ * calling thread.  Inside a batch, `mmu_resident`,
+ * `mmu_resident_run`, `mmu_nonresident` and `mmu_chprot` return as
+ * soon as their message is queued, so changes to several processes
+ * proceed in parallel; `mmu_batch_end` returns once all of them are
+ * complete.  Changes to the same process are applied in the order
+ * they were made.  Batches may be nested; only the outermost
+ * `mmu_batch_end` waits.  */
+void mmu_batch_begin(void);
+void mmu_batch_end(void);
 
 /* `mmu_zero_fill` will fill `frame` with zeroes (character '0').
  * Your page should use this function to initialize memory before
@@ -39,6 +50,12 @@ void mmu_zero_fill(int frame);
  * | PROT_WRITE`; these constants are defined in <sys/mman.h>.  */
 void mmu_resident(pid_t pid, void *vaddr, int frame, int prot);
 
+/* `mmu_resident_run` is like `mmu_resident`, but maps `npages`
+ * consecutive pages starting at `vaddr` to consecutive frames
+ * starting at `frame` with a single message and system call.  */
+void mmu_resident_run(pid_t pid, void *vaddr, int frame, int npages,
+		int prot);
+
 /* `mmu_nonresident` will mark the page starting at `vaddr` as
  * inacessible by process `pid`.  See `mmu_resident` above for the
  * semantics on `vaddr` and `prot`.  */
@@ -46,9 +63,20 @@ void mmu_nonresident(pid_t pid, void *vaddr);
 
 /* `mmu_chprot` will change access permissions for the page starting
  * at `vaddr` to `prot`.  See `mmu_resident` above for the semantics
- * on `vaddr` and `prot`.  */
+ * on `vaddr` and `prot`.  When the MMU_LAZY_INVALIDATE environment
+ * variable is set, changes to `PROT_NONE` for a process that has no
+ * request in progress return immediately and only take effect when
+ * the process next sends a request or is sent another change; until
+ * then the process's accesses to the page do not fault.  */
 void mmu_chprot(pid_t pid, void *vaddr, int prot);
 
+/* `mmu_chprot_pending` returns 1 if a change of the page starting at
+ * `vaddr` to `PROT_NONE` was deferred and not yet sent to process
+ * `pid`, and 0 otherwise.  Accesses to such a page go unnoticed, so
+ * your pager should not take its protection as a sign that the page
+ * was not used.  */
+int mmu_chprot_pending(pid_t pid, void *vaddr);
+
 /* `mmu_disk_read` copies content from disk block `block_from` into
  * physical frame `frame_to`.  `mmu_disk_write` copies content from
  * frame `frame_from` to disk block `block_to`.  Your pager shoudl
@@ -56,4 +84,21 @@ void mmu_chprot(pid_t pid, void *vaddr, int prot);
 void mmu_disk_read(int block_from, int frame_to);
 void mmu_disk_write(int frame_from, int block_to);
 
+/* `mmu_disk_writev` copies the `n` frames in `frames_from` to the
+ * `n` consecutive disk blocks starting at `block_to` in a single
+ * transfer.  Your pager can use this function to cluster the
+ * write-back of several paged-out frames.  */
+void mmu_disk_writev(const int *frames_from, int n, int block_to);
+
+/* `mmu_disk_move` copies content from disk block `block_from` to
+ * disk block `block_to`, without going through a frame.  Your pager
+ * can use this function to migrate paged-out data between blocks.  */
+void mmu_disk_move(int block_from, int block_to);
+
+/* `mmu_disk_block` returns a pointer to the contents of disk block
+ * `block`.  Your pager should never write through this pointer; it
+ * can be used to read paged-out data without loading it into a
+ * frame.  */
+const char *mmu_disk_block(int block);
+
 #endif
@@ -12,26 +12,73 @@
  * The `CREATE` message and its reply are exchanged before the
  * `vmu_thread` starts.  Clients send their PID to the MMU, and
  * receive the path to the memory-mapped file representing physical
- * memory.
+ * memory.  A client may also send a `token` naming it across runs;
+ * if the MMU kept the pages of an earlier process with the same
+ * token (see MMU_PERSIST in pager.h), the reply's `npages` is the
+ * number of pages the new process starts with, beginning at
+ * `UVM_BASEADDR`.
  *
- * The `EXTEND` and `SEGV` messages are generated by the client when
- * they allocate memory and experience a segmentation fault,
- * respectively.  The request functions (`uvm_extend` and
- * `uvm_segv_action`) wait on a condition variable for the request
- * to be serviced.
+ * The `EXTEND`, `SYSLOG` and `SEGV` messages are generated by the
+ * client when it allocates memory, logs a string and experiences a
+ * segmentation fault, respectively.  Each request carries a `reqid`
+ * chosen by the client, which the MMU copies into the reply.
+ * Threads in a client may have several requests in flight, and
+ * replies may arrive in any order; each request function
+ * (`uvm_extend`, `uvm_syslog` and `uvm_segv_action`) waits on the
+ * completion slot identified by its `reqid`.  An `EXTEND` reserves
+ * up to `npages` consecutive pages and its reply carries the address
+ * of the first page and the number of pages reserved; an `EXTENDV`
+ * makes up to `MMU_PROTO_EXTENDV_MAX` such reservations in a single
+ * round-trip.  The `retcode` in `SYSLOG` and `SEGV` replies is 0 on
+ * success and minus the pager's `errno` on failure.  A `STATS` reply
+ * carries the MMU's event counters and, for each request type, the
+ * number of requests handled and their mean, median, 99th
+ * percentile and maximum service times in nanoseconds.
  *
  * The `REMAP` and `CHPROT` messages are generated by the MMU and
  * are processed by `uvm_thread` asynchronously.  These messages are
  * used to service sergmentation faults and whenever the pager pages
- * some of the processes pages to disk. */
+ * some of the processes pages to disk.  The client acknowledges
+ * each of them, in order, with the corresponding `REQ` message.
+ * A `REMAP` maps `npages` consecutive pages starting at `vaddr` to
+ * consecutive frames starting at `offset` in a single call.
+ *
+ * Messages are framed according to the version negotiated at
+ * creation.  A `CREATE` uses `MMU_PROTO_V1` throughout, where each
+ * message is sent as-is and its size follows from its type.  Clients
+ * that support later versions send a `CREATE2` instead, asking for
+ * `version`; its reply carries the version both sides use from then
+ * on, the lower of the two supported.  The `CREATE2` messages
+ * themselves are sent as in `MMU_PROTO_V1`, and an MMU that predates
+ * them drops the connection.  In `MMU_PROTO_V2` each message is preceded
+ * by a `mmu_proto_frame` with its length in bytes; receivers skip
+ * messages of unknown types, ignore bytes past the end of the
+ * messages they know and treat missing ones as zeros.  See frame.h. */
 
 #ifndef __MMUPROTO_HEADER__
 #define __MMUPROTO_HEADER__
 
+/* The MMU listens on `MMU_PROTO_UNIX_PATH` in its working directory.
+ * When the MMU_READY_FD environment variable holds a file descriptor
+ * number, the MMU writes a line to that descriptor and closes it once
+ * it is ready to serve clients, so scripts can wait on a pipe instead
+ * of sleeping.  Clients retry `connect` with a short exponential
+ * backoff while the socket does not exist or refuses connections,
+ * for at most `MMU_PROTO_CONNECT_MS` milliseconds. */
+#define MMU_PROTO_CONNECT_MS 3000
+
 /* From UNIX_PATH_MAX, see man (7) unix: */
 #define MMU_PROTO_PATH_MAX 108
 #define MMU_PROTO_UNIX_PATH "mmu.sock"
 
+#define MMU_PROTO_V1 1
+#define MMU_PROTO_V2 2
+#define MMU_PROTO_VERSION MMU_PROTO_V2
+
+struct mmu_proto_frame {
+	uint32_t len;
+} __attribute__((packed));
+
 #define MMU_PROTO_CREATE_REQ 1
 #define MMU_PROTO_CREATE_REP 2
 #define MMU_PROTO_EXTEND_REQ 3
@@ -44,46 +91,111 @@
 #define MMU_PROTO_REMAP_REP 10
 #define MMU_PROTO_CHPROT_REQ 11
 #define MMU_PROTO_CHPROT_REP 12
+#define MMU_PROTO_EXTENDV_REQ 13
+#define MMU_PROTO_EXTENDV_REP 14
+#define MMU_PROTO_STATS_REQ 15
+#define MMU_PROTO_STATS_REP 16
+#define MMU_PROTO_CREATE2_REQ 17
+#define MMU_PROTO_CREATE2_REP 18
 #define MMU_PROTO_EXIT_REQ 32
 #define MMU_PROTO_EXIT_REP 33
 
+#define MMU_PROTO_EXTENDV_MAX 16
+#define MMU_PROTO_TOKEN_MAX 32
+#define MMU_PROTO_STATS_COUNTERS 8
+#define MMU_PROTO_STATS_HISTS 5
+
 struct mmu_proto_create_req {
 	uint32_t type;
 	uint32_t pid;
+	char token[MMU_PROTO_TOKEN_MAX];
 } __attribute__((packed));
 struct mmu_proto_create_rep {
 	uint32_t type;
 	char pmem_fn[MMU_PROTO_PATH_MAX];
+	uint32_t npages;
+} __attribute__((packed));
+
+/* as `CREATE`, with the protocol version appended */
+struct mmu_proto_create2_req {
+	uint32_t type;
+	uint32_t pid;
+	char token[MMU_PROTO_TOKEN_MAX];
+	uint32_t version;
+} __attribute__((packed));
+struct mmu_proto_create2_rep {
+	uint32_t type;
+	char pmem_fn[MMU_PROTO_PATH_MAX];
+	uint32_t npages;
+	uint32_t version;
 } __attribute__((packed));
 
 struct mmu_proto_extend_req {
 	uint32_t type;
+	uint32_t reqid;
+	uint32_t npages;
 } __attribute__((packed));
 struct mmu_proto_extend_rep {
 	uint32_t type;
+	uint32_t reqid;
 	uint64_t vaddr;
+	uint32_t npages;
+} __attribute__((packed));
+
+struct mmu_proto_extendv_req {
+	uint32_t type;
+	uint32_t reqid;
+	uint32_t count;
+	uint32_t npages[MMU_PROTO_EXTENDV_MAX];
+} __attribute__((packed));
+struct mmu_proto_extendv_rep {
+	uint32_t type;
+	uint32_t reqid;
+	uint32_t count;
+	uint64_t vaddr[MMU_PROTO_EXTENDV_MAX];
+	uint32_t npages[MMU_PROTO_EXTENDV_MAX];
 } __attribute__((packed));
 
 struct mmu_proto_syslog_req {
 	uint32_t type;
+	uint32_t reqid;
 	uint32_t len;
 	uint64_t addr;
 } __attribute__((packed));
 struct mmu_proto_syslog_rep {
 	uint32_t type;
+	uint32_t reqid;
 	uint32_t retcode;
 } __attribute__((packed));
 
 struct mmu_proto_segv_req {
 	uint32_t type;
+	uint32_t reqid;
 	int32_t code;
 	uint64_t addr;
 } __attribute__((packed));
 struct mmu_proto_segv_rep {
 	uint32_t type;
+	uint32_t reqid;
+	int32_t retcode;
 } __attribute__((packed));
 // segv causes remap and chprot to happen
 
+struct mmu_proto_stats_req {
+	uint32_t type;
+	uint32_t reqid;
+} __attribute__((packed));
+struct mmu_proto_stats_rep {
+	uint32_t type;
+	uint32_t reqid;
+	uint64_t counters[MMU_PROTO_STATS_COUNTERS];
+	uint64_t count[MMU_PROTO_STATS_HISTS];
+	uint64_t mean[MMU_PROTO_STATS_HISTS];
+	uint64_t p50[MMU_PROTO_STATS_HISTS];
+	uint64_t p99[MMU_PROTO_STATS_HISTS];
+	uint64_t max[MMU_PROTO_STATS_HISTS];
+} __attribute__((packed));
+
 struct mmu_proto_remap_req {
 	uint32_t type;
 } __attribute__((packed));
@@ -92,6 +204,7 @@ struct mmu_proto_remap_rep {
 	int32_t prot;
 	uint64_t offset;
 	uint64_t vaddr;
+	uint32_t npages;
 } __attribute__((packed));
 
 struct mmu_proto_chprot_req {
@@ -0,0 +1,77 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+/* This program prints the text trace recorded in a binary MMU trace (see
+ * =trace_init=).  Events are printed in the order they happened. */
+
+struct record {
+	struct trace_event ev;
+	char *data;
+};
+
+static int record_cmp(const void *va, const void *vb) /* {{{ */
+{
+	const struct record *a = va;
+	const struct record *b = vb;
+	return (a->ev.seq > b->ev.seq) - (a->ev.seq < b->ev.seq);
+} /* }}} */
+
+int main(int argc, char **argv) /* {{{ */
+{
+	if(argc != 2) {
+		fprintf(stderr, "usage: %s TRACE\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	FILE *file = fopen(argv[1], "rb");
+	if(!file) {
+		perror(argv[1]);
+		exit(EXIT_FAILURE);
+	}
+	char magic[8];
+	uint32_t size;
+	if(fread(magic, sizeof(magic), 1, file) != 1
+			|| memcmp(magic, TRACE_MAGIC, sizeof(magic))
+			|| fread(&size, sizeof(size), 1, file) != 1
+			|| size != sizeof(struct trace_event)) {
+		fprintf(stderr, "%s: not a binary MMU trace\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+
+	/* threads drain in any order, so all records are read first */
+	size_t n = 0;
+	size_t cap = 1024;
+	struct record *records = malloc(cap * sizeof(*records));
+	if(!records) exit(EXIT_FAILURE);
+	struct trace_event ev;
+	while(fread(&ev, sizeof(ev), 1, file) == 1) {
+		size_t padded = ((size_t)ev.len + 7) & ~(size_t)7;
+		char *data = malloc(padded + 1);
+		if(!data) exit(EXIT_FAILURE);
+		if(padded && fread(data, padded, 1, file) != 1) {
+			fprintf(stderr, "%s: truncated record\n", argv[1]);
+			free(data);
+			break;
+		}
+		if(n == cap) {
+			cap *= 2;
+			records = realloc(records, cap * sizeof(*records));
+			if(!records) exit(EXIT_FAILURE);
+		}
+		records[n].ev = ev;
+		records[n].data = data;
+		n++;
+	}
+	fclose(file);
+
+	qsort(records, n, sizeof(*records), record_cmp);
+	for(size_t i = 0; i < n; ++i) {
+		trace_format(stdout, &records[i].ev, records[i].data);
+		free(records[i].data);
+	}
+	free(records);
+	return 0;
+} /* }}} */
@@ -1,13 +1,21 @@
+#include <errno.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <stdbool.h>
 
+#include "hex.h"
 #include "mmu.h"
 #include "pager.h"
+#include "sink.h"
+#include "slab.h"
+#include "stats.h"
 
 /* --- Data structures definitions --- */
 
@@ -17,23 +25,24 @@
 struct table_entry{
     intptr_t page_number;
     bool in_mem;
+    // Page was written since it was last brought into memory
     bool wrote;
+    // Disk block holds the page contents
+    bool on_disk;
     int frame;
     int prot;
     int disk_block;
     pid_t pid;
-    struct table_entry* next;
 };
 
 /* A table containing information about pages in the memory */
 struct page_table {
-    // Page list
-    struct table_entry* head;
-    struct table_entry* tail;
+    // Entry resident in each frame (NULL if the frame is free)
+    struct table_entry** frames;
     // Mutex for sync
     pthread_mutex_t mutex;
-    // Ptr to perform the second change algoritm
-    struct table_entry* ptr;
+    // Ptr to perform the second change algoritm (next frame to check)
+    int ptr;
 };
 
 /* PROCESS_LIST */
@@ -46,8 +55,6 @@ struct p_pages_node{
     bool used;
     // Mapped entry in the page table
     struct table_entry* entry;
-    // Entry right before
-    struct table_entry* previous_entry;
     // Next process page
     struct p_pages_node* next;
 };
@@ -57,14 +64,29 @@ struct p_pages {
     struct p_pages_node* tail;
 };
 
+#define PAGE_SIZE ((intptr_t)0x1000)
+
+// Maximum number of pages a process can allocate
+#define MAX_PROC_PAGES ((UVM_MAXADDR - UVM_BASEADDR + 1) / PAGE_SIZE)
+
+// Number of objects carved from each slab chunk
+#define PAGES_PER_CHUNK 64
+#define PROCS_PER_CHUNK 32
+
 // List of processes with declared pages
 struct plist_node {
     // Process id
     pid_t pid;
+    // Token the process identified itself with (empty if none)
+    char token[PAGER_TOKEN_MAX];
     // Number of allocated pages
     int n_pages;
     // Process pages
-    struct p_pages* p_pages;
+    struct p_pages p_pages;
+    // Arenas holding the process's page nodes and page table entries,
+    // released all at once when the process exits
+    struct slab_arena pages_arena;
+    struct slab_arena entries_arena;
     // Next process
     struct plist_node* next;
 };
@@ -77,8 +99,62 @@ struct plist {
     struct plist_node* tail;
     // Mutex for sync
     pthread_mutex_t mutex;
+    // Arena for process nodes (protected by the mutex)
+    struct slab_arena arena;
+};
+
+
+/* PERSISTENCE */
+
+// Pages of a process identified by a token, kept in swap while no process
+// with that token is running (MMU_PERSIST)
+struct saved_image{
+    char token[PAGER_TOKEN_MAX];
+    int n_pages;
+    // Block of each page (-1 if none) and whether it holds the page's data
+    int* blocks;
+    bool* on_disk;
+    struct saved_image* next;
 };
 
+// Snapshot of the saved images written by pager_save: a header with the
+// magic, the number of blocks and the number of images, then each image's
+// token, page count, blocks and on_disk flags
+#define SNAPSHOT_MAGIC "MMUSWAP1"
+#define SNAPSHOT_FILE "mmu.pages"
+
+/* SYSLOG */
+
+// Iterator over the pages spanned by a range of a process's address space
+struct page_span{
+    // Current page, its number, and the piece of it inside the range
+    struct p_pages_node* page;
+    intptr_t page_number;
+    intptr_t offset;
+    size_t len;
+    // Bytes of the range after the current piece
+    size_t remaining;
+};
+
+// Bytes of process memory encoded before each write to the sink
+#define SYSLOG_CHUNK 0x8000
+
+// Per-thread output buffer reused across syslog calls
+struct syslog_buf{
+    char* data;
+    size_t size;
+};
+
+// Where syslog reads pages that are not resident
+#define SYSLOG_SOURCE_FAULT 0   // Page them in, as a read access would
+#define SYSLOG_SOURCE_SWAP 1    // Read them from their disk block
+
+
+// A dirty victim waiting to be written back
+struct writeback{
+    int frame;
+    int block;
+};
 
 /* struct to manage frames */
 struct frames{
@@ -89,10 +165,21 @@ struct frames{
     bool* arr;
 };
 
+// How pager_extend commits swap (MMU_OVERCOMMIT)
+#define OVERCOMMIT_STRICT 0     // Reserve a block for each page at extend time
+#define OVERCOMMIT_HEURISTIC 1  // Refuse extends beyond the frames plus blocks
+#define OVERCOMMIT_ALWAYS 2     // Never refuse an extend for lack of swap
+
+// Pages swapped in with each page read from disk (MMU_READAHEAD overrides it);
+// 1 reads only the faulting page
+#define READAHEAD_DEFAULT 1
+
 /* struct to manage blocks */
 struct blocks{
     int total_blocks;
     int free_blocks;
+    // Pages allocated to all processes, backed by a block or not
+    int committed;
     pthread_mutex_t mutex;
     // Array to track used disk blocks. 1 represents an used block and 0 a free block.
     bool* arr;
@@ -104,7 +191,41 @@ struct plist plist;
 struct frames frames;
 struct blocks blocks;
 
+// Slab caches for the fixed-size pager structures
+struct slab_cache* entry_cache;
+struct slab_cache* page_cache;
+struct slab_cache* proc_cache;
+
+// Syslog configuration (MMU_SYSLOG_SINK and MMU_SYSLOG_SOURCE)
+struct sink* syslog_sink;
+int syslog_source;
+// Overcommit mode (MMU_OVERCOMMIT)
+int overcommit;
+// Blocks migrated by each compaction pass (MMU_SWAP_COMPACT, 0 disables it)
+int compact_budget;
+// Pages reclaimed each time memory runs out (MMU_RECLAIM_BATCH)
+int reclaim_batch;
+// Pages swapped in with each page read from disk (MMU_READAHEAD)
+int readahead;
+// Directory holding the swap and the snapshot (MMU_PERSIST, NULL if unset)
+const char* persist_dir;
+// Saved images (protected by the plist mutex)
+struct saved_image* saved_images;
+// Contents of a zero-filled page
+char zero_page[PAGE_SIZE];
+
 /* Utils methods*/
+struct plist_node* getProcess(pid_t pid);
+
+// Lock a pager mutex, accounting the time spent waiting if it is contended
+void lockMutex(pthread_mutex_t* mutex)
+{
+    if(pthread_mutex_trylock(mutex) == 0) return;
+    uint64_t start = stats_now();
+    pthread_mutex_lock(mutex);
+    stats_add(STATS_LOCK_WAIT, stats_now() - start);
+}
+
 int getFreeFrame()
 {
     int res = -1;
@@ -165,64 +286,630 @@ void freeMemoryFrame(int i)
 
 intptr_t getVAddr(int pageNumber)
 {
-    return UVM_BASEADDR + pageNumber * ((intptr_t)0x1000);
+    return UVM_BASEADDR + pageNumber * PAGE_SIZE;
+}
+
+struct p_pages_node* getPage(struct plist_node* process, intptr_t page_number)
+{
+    struct p_pages_node* currPage = process->p_pages.head;
+    for(intptr_t i = 0; i < page_number; i++, currPage = currPage->next);
+    return currPage;
+}
+
+// Block holding a page: page table entries keep it once the page is used
+int* pageBlock(struct p_pages_node* page)
+{
+    return page->used ? &page->entry->disk_block : &page->disc_block;
+}
+
+// First block of the lowest run of `want` free blocks, or -1 (run this method with the blocks mutex locked)
+int getFreeRun(int want)
+{
+    int len = 0;
+    for(int i = 0; i < blocks.total_blocks; i++)
+    {
+        len = blocks.arr[i] ? 0 : len + 1;
+        if(len == want) return i - want + 1;
+    }
+    return -1;
+}
+
+// Pick a free block for a page whose virtual predecessor is in block `prev`
+// (-1 if none): the next block keeps the two contiguous; otherwise start a
+// new run where `want` blocks fit, or take the lowest free block (run this
+// method with the blocks mutex locked)
+int pickBlock(int prev, int want)
+{
+    if(prev != -1 && prev + 1 < blocks.total_blocks && !blocks.arr[prev + 1]) return prev + 1;
+    int block = getFreeRun(want);
+    if(block == -1) block = getFreeBlock();
+    return block;
+}
+
+// Make sure a dirty page has a disk block to be written to, allocating one
+// if swap was overcommitted (run this method with the page table mutex locked)
+bool reserveBlock(struct table_entry* entry)
+{
+    if(!entry->wrote || entry->disk_block != -1) return true;
+    // Place the page after its virtual predecessor
+    int prev = -1;
+    struct plist_node* process = getProcess(entry->pid);
+    if(entry->page_number > 0) prev = *pageBlock(getPage(process, entry->page_number - 1));
+    lockMutex(&blocks.mutex);
+    if(blocks.free_blocks)
+    {
+        entry->disk_block = pickBlock(prev, 1);
+        allocateDiskBlock(entry->disk_block);
+    }
+    pthread_mutex_unlock(&blocks.mutex);
+    return entry->disk_block != -1;
+}
+
+// Clock (second chance) algorithm over frames (run this method with the page table mutex locked)
+int getVictimFrame()
+{
+    // Two sweeps see every page with its second chance used up; dirty
+    // pages that cannot get a disk block are passed over, and if no page
+    // can be evicted swap is exhausted
+    int victim = -1;
+    // First page whose downgrade the MMU deferred; the process may have
+    // used it since, so it is only taken if no other page can be
+    int deferred = -1;
+    int i = 0;
+    // Second chances given during the sweep are waited for together
+    mmu_batch_begin();
+    for(; i < 2 * frames.total_frames; i++)
+    {
+        int frame = page_table.ptr;
+        struct table_entry* entry = page_table.frames[frame];
+        page_table.ptr = (page_table.ptr + 1) % frames.total_frames;
+        // Frames released by pager_destroy are skipped until reallocated
+        if(entry == NULL) continue;
+        if(entry->prot == PROT_NONE)
+        {
+            if(mmu_chprot_pending(entry->pid, (void*)getVAddr(entry->page_number)))
+            {
+                if(deferred == -1) deferred = frame;
+                continue;
+            }
+            if(!reserveBlock(entry)) continue;
+            victim = frame;
+            i++;
+            break;
+        }
+        // Give the page a second chance
+        entry->prot = PROT_NONE;
+        mmu_chprot(entry->pid, (void*)getVAddr(entry->page_number), PROT_NONE);
+    }
+    mmu_batch_end();
+    if(victim == -1 && deferred != -1 && reserveBlock(page_table.frames[deferred])) victim = deferred;
+    stats_add(STATS_SWEEP, i);
+    return victim;
+}
+
+// Page the victim chosen by the clock out of memory and return its frame,
+// or -1 if no page can be evicted
+int evictPage()
+{
+    int frame = getVictimFrame();
+    if(frame == -1) return -1;
+    struct table_entry* dead_entry = page_table.frames[frame];
+    dead_entry->in_mem = 0;
+    mmu_nonresident(dead_entry->pid, (void*)getVAddr(dead_entry->page_number));
+    stats_add(STATS_EVICT, 1);
+    // Only pages written since they were loaded go to disk
+    if(dead_entry->wrote)
+    {
+        mmu_disk_write(frame, dead_entry->disk_block);
+        dead_entry->wrote = 0;
+        dead_entry->on_disk = 1;
+    }
+    page_table.frames[frame] = NULL;
+    return frame;
 }
 
-// Clock (second chance) algorithm (run this method with the mutex locked)
-struct table_entry* getUnusedPage()
+int compareWriteback(const void* a, const void* b)
 {
-    // Initialize page_table.ptr
-    if(page_table.ptr == NULL)page_table.ptr = page_table.head;
-    while(page_table.ptr->prot != PROT_NONE)
+    return ((const struct writeback*)a)->block - ((const struct writeback*)b)->block;
+}
+
+// Write the queued victims back sorted by block, one transfer per run of
+// consecutive blocks
+void flushWriteback(struct writeback* queue, int n)
+{
+    qsort(queue, n, sizeof(*queue), compareWriteback);
+    int run_frames[n];
+    for(int start = 0, end; start < n; start = end)
     {
-        // Only consider pages in memory
-        if(page_table.ptr->in_mem == 1)
+        run_frames[0] = queue[start].frame;
+        for(end = start + 1; end < n && queue[end].block == queue[end - 1].block + 1; end++)
+            run_frames[end - start] = queue[end].frame;
+        if(end - start == 1) mmu_disk_write(queue[start].frame, queue[start].block);
+        else mmu_disk_writev(run_frames, end - start, queue[start].block);
+    }
+}
+
+// Page up to `n` victims chosen by the clock out of memory, clustering the
+// write-back of dirty ones, and return their frames to the free pool (run
+// this method with the page table mutex locked)
+int reclaimFrames(int n)
+{
+    int victims[n];
+    struct writeback queue[n];
+    int n_victims = 0;
+    int n_dirty = 0;
+    // Victims are unmapped in parallel, and must all be unmapped before
+    // their frames are written back
+    mmu_batch_begin();
+    for(; n_victims < n; n_victims++)
+    {
+        int frame = getVictimFrame();
+        if(frame == -1) break;
+        struct table_entry* dead_entry = page_table.frames[frame];
+        dead_entry->in_mem = 0;
+        mmu_nonresident(dead_entry->pid, (void*)getVAddr(dead_entry->page_number));
+        if(dead_entry->wrote)
         {
-            if(page_table.ptr == NULL)page_table.ptr = page_table.head;
-            // Change page protection
-            page_table.ptr->prot = PROT_NONE;
-            pid_t pid = page_table.ptr->pid;
-            intptr_t addr = getVAddr(page_table.ptr->page_number);
-            mmu_chprot(pid, (void*)addr, PROT_NONE);
-            // Go to next page
+            queue[n_dirty].frame = frame;
+            queue[n_dirty].block = dead_entry->disk_block;
+            n_dirty++;
+            dead_entry->wrote = 0;
+            dead_entry->on_disk = 1;
         }
-        page_table.ptr = page_table.ptr->next;
-        if(page_table.ptr == NULL)page_table.ptr = page_table.head;
+        // The clock skips the frame from now on
+        page_table.frames[frame] = NULL;
+        victims[n_victims] = frame;
     }
-    struct table_entry* dead_entry = page_table.ptr;
-    page_table.ptr = page_table.ptr->next;
-    return dead_entry;
+    stats_add(STATS_EVICT, n_victims);
+    mmu_batch_end();
+    flushWriteback(queue, n_dirty);
+    lockMutex(&frames.mutex);
+    for(int i = 0; i < n_victims; i++) freeMemoryFrame(victims[i]);
+    pthread_mutex_unlock(&frames.mutex);
+    return n_victims;
+}
+
+// Get the lowest free frame, or evict a page if memory is full; returns -1
+// if memory is full and no page can be evicted (run this method with the
+// page table mutex locked)
+int getFrame()
+{
+    int frame = -1;
+    lockMutex(&frames.mutex);
+    if(!frames.free_frames && reclaim_batch > 1)
+    {
+        // Free several frames at once so their write-back is clustered
+        pthread_mutex_unlock(&frames.mutex);
+        reclaimFrames(reclaim_batch);
+        lockMutex(&frames.mutex);
+    }
+    if(frames.free_frames)
+    {
+        frame = getFreeFrame();
+        allocateFrame(frame);
+    }
+    pthread_mutex_unlock(&frames.mutex);
+    if(frame == -1) frame = evictPage();
+    return frame;
+}
+
+// Start iterating over the `len` bytes at offset `start` of the process's address space
+void spanInit(struct page_span* span, struct plist_node* process, intptr_t start, size_t len)
+{
+    span->page_number = start / PAGE_SIZE;
+    span->page = getPage(process, span->page_number);
+    span->offset = start % PAGE_SIZE;
+    span->len = 0;
+    span->remaining = len;
+}
+
+// Move to the next piece of the range, returning false after the last one
+bool spanNext(struct page_span* span)
+{
+    if(span->len)
+    {
+        span->page = span->page->next;
+        span->page_number++;
+        span->offset = 0;
+    }
+    if(span->remaining == 0) return false;
+    span->len = PAGE_SIZE - span->offset;
+    if(span->len > span->remaining) span->len = span->remaining;
+    span->remaining -= span->len;
+    return true;
+}
+
+pthread_key_t syslog_key;
+pthread_once_t syslog_once = PTHREAD_ONCE_INIT;
+
+void freeSyslogBuffer(void* data)
+{
+    struct syslog_buf* buf = (struct syslog_buf*)data;
+    free(buf->data);
+    free(buf);
+}
+
+void createSyslogKey()
+{
+    pthread_key_create(&syslog_key, freeSyslogBuffer);
+}
+
+// Get the calling thread's syslog buffer with room for at least `size` bytes
+char* getSyslogBuffer(size_t size)
+{
+    pthread_once(&syslog_once, createSyslogKey);
+    struct syslog_buf* buf = (struct syslog_buf*)pthread_getspecific(syslog_key);
+    if(buf == NULL)
+    {
+        buf = (struct syslog_buf*)calloc(1, sizeof(struct syslog_buf));
+        if(buf == NULL) return NULL;
+        pthread_setspecific(syslog_key, buf);
+    }
+    if(buf->size < size || buf->data == NULL)
+    {
+        char* data = (char*)realloc(buf->data, size ? size : 1);
+        if(data == NULL) return NULL;
+        buf->data = data;
+        buf->size = size;
+    }
+    return buf->data;
+}
+
+// Take the free frames following `frame` for the pages following `page`
+// whose data sits in the blocks following `block`, up to `readahead` pages in
+// all, and read them in; returns the number of pages read (run this method
+// with the page table mutex locked)
+int readAhead(struct p_pages_node* page, int frame, int block)
+{
+    int n = 0;
+    lockMutex(&frames.mutex);
+    for(struct p_pages_node* next = page->next; next != NULL && n + 1 < readahead; next = next->next)
+    {
+        struct table_entry* entry = next->entry;
+        int f = frame + n + 1;
+        if(!next->used || entry->in_mem || !entry->on_disk || entry->disk_block != block + n + 1) break;
+        if(f >= frames.total_frames || frames.arr[f]) break;
+        allocateFrame(f);
+        n++;
+    }
+    pthread_mutex_unlock(&frames.mutex);
+    struct p_pages_node* next = page->next;
+    for(int i = 1; i <= n; i++, next = next->next)
+    {
+        struct table_entry* entry = next->entry;
+        mmu_disk_read(entry->disk_block, frame + i);
+        entry->frame = frame + i;
+        entry->in_mem = 1;
+        entry->prot = PROT_READ;
+        page_table.frames[frame + i] = entry;
+    }
+    return n;
+}
+
+// Make a page resident and readable, as on a read access; returns -1 and sets
+// errno to ENOMEM if there is no frame for it (run this method with the plist
+// and page table mutexes locked)
+int readAccess(struct plist_node* process, struct p_pages_node* currPage, intptr_t page_number)
+{
+    pid_t pid = process->pid;
+    void* page_addr = (void*)getVAddr(page_number);
+    // First use memory: zero-fill a frame for the page
+    if(!currPage->used)
+    {
+        int frame = getFrame();
+        if(frame == -1)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        struct table_entry* new_entry = (struct table_entry*)slab_alloc(&process->entries_arena);
+        currPage->entry = new_entry;
+        new_entry->frame = frame;
+        new_entry->disk_block = currPage->disc_block;
+        new_entry->page_number = page_number;
+        new_entry->prot = PROT_READ;
+        new_entry->pid = pid;
+        new_entry->in_mem = 1;
+        new_entry->wrote = 0;
+        new_entry->on_disk = 0;
+        page_table.frames[frame] = new_entry;
+        mmu_zero_fill(frame);
+        stats_add(STATS_FAULT_ZERO, 1);
+        currPage->used = 1;
+        mmu_resident(pid, page_addr, frame, PROT_READ);
+        return 0;
+    }
+    struct table_entry* currEntry = currPage->entry;
+    if(currEntry->in_mem)
+    {
+        // Page lost its second chance: only restore read access
+        if(currEntry->prot == PROT_NONE)
+        {
+            currEntry->prot = PROT_READ;
+            mmu_chprot(pid, page_addr, PROT_READ);
+            stats_add(STATS_FAULT_PROT, 1);
+        }
+        return 0;
+    }
+    // Bring the page back, from disk if it was ever written there
+    int frame = getFrame();
+    if(frame == -1)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    if(currEntry->on_disk) mmu_disk_read(currEntry->disk_block, frame);
+    else mmu_zero_fill(frame);
+    stats_add(currEntry->on_disk ? STATS_FAULT_SWAPIN : STATS_FAULT_ZERO, 1);
+    // Update curr entry status
+    currEntry->frame = frame;
+    currEntry->in_mem = 1;
+    currEntry->prot = PROT_READ;
+    page_table.frames[frame] = currEntry;
+    // Pages swapped out together come back in the same mapping
+    int ahead = 0;
+    if(currEntry->on_disk) ahead = readAhead(currPage, frame, currEntry->disk_block);
+    if(ahead) mmu_resident_run(pid, page_addr, frame, ahead + 1, PROT_READ);
+    else mmu_resident(pid, page_addr, frame, PROT_READ);
+    return 0;
+}
+
+struct plist_node* getProcess(pid_t pid)
+{
+    struct plist_node* currProcess = plist.head;
+    while(currProcess != NULL && currProcess->pid != pid) currProcess = currProcess->next;
+    return currProcess;
+}
+
+// Get the bytes of a page for syslog (run this method with the plist and page table mutexes locked)
+const char* syslogSource(struct plist_node* process, struct p_pages_node* page, intptr_t page_number)
+{
+    if(syslog_source == SYSLOG_SOURCE_SWAP)
+    {
+        // Read the data wherever it is, without changing any mapping
+        if(!page->used) return zero_page;
+        struct table_entry* entry = page->entry;
+        if(entry->in_mem) return pmem + entry->frame * PAGE_SIZE;
+        if(entry->on_disk) return mmu_disk_block(entry->disk_block);
+        return zero_page;
+    }
+    if(readAccess(process, page, page_number) == -1) return NULL;
+    return pmem + page->entry->frame * PAGE_SIZE;
+}
+
+// Close the sink at exit so ring sinks get dumped
+void closeSyslogSink()
+{
+    sink_close(syslog_sink);
+}
+
+// Send a syslog chunk to the sink
+void syslogFlush(const char* buf, size_t len, bool last)
+{
+    struct iovec iov[2];
+    iov[0].iov_base = (void*)buf;
+    iov[0].iov_len = len;
+    iov[1].iov_base = "\n";
+    iov[1].iov_len = 1;
+    sink_write(syslog_sink, iov, last ? 2 : 1);
 }
 
 /* External functions */
 
+// Migrate up to `budget` blocks so each process's pages sit in contiguous
+// runs: a page moves to the block after its virtual predecessor's when that
+// block is free (run this method with the plist mutex locked)
+void compactSwap(int budget)
+{
+    lockMutex(&page_table.mutex);
+    lockMutex(&blocks.mutex);
+    for(struct plist_node* process = plist.head; process != NULL && budget > 0; process = process->next)
+    {
+        int prev = -1;
+        for(struct p_pages_node* page = process->p_pages.head; page != NULL && budget > 0; page = page->next)
+        {
+            int* block = pageBlock(page);
+            if(*block == -1) continue;
+            int target = prev + 1;
+            if(prev != -1 && *block != target && target < blocks.total_blocks && !blocks.arr[target])
+            {
+                // Only data written to disk has to be copied
+                if(page->used && page->entry->on_disk) mmu_disk_move(*block, target);
+                allocateDiskBlock(target);
+                freeDiskBlock(*block);
+                *block = target;
+                budget--;
+            }
+            prev = *block;
+        }
+    }
+    pthread_mutex_unlock(&blocks.mutex);
+    pthread_mutex_unlock(&page_table.mutex);
+}
+
+void freeImage(struct saved_image* image)
+{
+    free(image->blocks);
+    free(image->on_disk);
+    free(image);
+}
+
+struct saved_image* allocImage(const char* token, int n_pages)
+{
+    struct saved_image* image = (struct saved_image*)calloc(1, sizeof(struct saved_image));
+    if(image == NULL) return NULL;
+    strncpy(image->token, token, PAGER_TOKEN_MAX - 1);
+    image->n_pages = n_pages;
+    image->blocks = (int*)malloc((n_pages + 1) * sizeof(int));
+    image->on_disk = (bool*)malloc((n_pages + 1) * sizeof(bool));
+    if(image->blocks == NULL || image->on_disk == NULL)
+    {
+        freeImage(image);
+        return NULL;
+    }
+    return image;
+}
+
+// Remove the image saved under `token` from the list (run this method with the plist mutex locked)
+struct saved_image* takeImage(const char* token)
+{
+    struct saved_image** link = &saved_images;
+    while(*link != NULL && strcmp((*link)->token, token) != 0) link = &(*link)->next;
+    struct saved_image* image = *link;
+    if(image != NULL) *link = image->next;
+    return image;
+}
+
+// Keep the pages of an exiting process in swap: dirty resident pages are
+// written back, and their blocks are not freed. Returns false if no image
+// could be recorded (run this method with the plist and page table mutexes
+// locked)
+bool saveImage(struct plist_node* process)
+{
+    struct saved_image* image = allocImage(process->token, process->n_pages);
+    if(image == NULL) return false;
+    int i = 0;
+    for(struct p_pages_node* page = process->p_pages.head; page != NULL; page = page->next, i++)
+    {
+        int* block = pageBlock(page);
+        image->on_disk[i] = page->used && page->entry->on_disk;
+        if(page->used && page->entry->in_mem && page->entry->wrote && reserveBlock(page->entry))
+        {
+            mmu_disk_write(page->entry->frame, *block);
+            image->on_disk[i] = true;
+        }
+        image->blocks[i] = *block;
+    }
+    // An older image with the same token is replaced
+    struct saved_image* old = takeImage(image->token);
+    if(old != NULL)
+    {
+        lockMutex(&blocks.mutex);
+        for(int j = 0; j < old->n_pages; j++) if(old->blocks[j] != -1) freeDiskBlock(old->blocks[j]);
+        blocks.committed -= old->n_pages;
+        pthread_mutex_unlock(&blocks.mutex);
+        freeImage(old);
+    }
+    image->next = saved_images;
+    saved_images = image;
+    return true;
+}
+
+// Read the images saved by the previous MMU instance; the snapshot is
+// ignored unless it matches the swap size and its blocks do not overlap
+void loadSnapshot()
+{
+    char path[PATH_MAX];
+    if(snprintf(path, sizeof(path), "%s/%s", persist_dir, SNAPSHOT_FILE) >= (int)sizeof(path))
+    {
+        fprintf(stderr, "%s: path too long, starting with empty swap\n", persist_dir);
+        return;
+    }
+    FILE* file = fopen(path, "rb");
+    if(file == NULL) return;
+    char magic[sizeof(SNAPSHOT_MAGIC) - 1];
+    int32_t header[2];
+    bool valid = fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0
+            && fread(header, sizeof(header), 1, file) == 1 && header[0] == blocks.total_blocks && header[1] >= 0;
+    for(int32_t i = 0; valid && i < header[1]; i++)
+    {
+        char token[PAGER_TOKEN_MAX];
+        int32_t n_pages;
+        valid = fread(token, sizeof(token), 1, file) == 1 && fread(&n_pages, sizeof(n_pages), 1, file) == 1
+                && n_pages >= 0 && n_pages <= MAX_PROC_PAGES;
+        if(!valid) break;
+        token[PAGER_TOKEN_MAX - 1] = '\0';
+        struct saved_image* image = allocImage(token, n_pages);
+        if(image == NULL) break;
+        int32_t block;
+        for(int j = 0; valid && j < n_pages; j++)
+        {
+            valid = fread(&block, sizeof(block), 1, file) == 1 && fread(&image->on_disk[j], sizeof(bool), 1, file) == 1
+                    && block >= -1 && block < blocks.total_blocks && (block == -1 || !blocks.arr[block]);
+            image->blocks[j] = block;
+            if(valid && block != -1) allocateDiskBlock(block);
+        }
+        image->next = saved_images;
+        saved_images = image;
+        blocks.committed += n_pages;
+    }
+    fclose(file);
+    if(valid) return;
+    fprintf(stderr, "%s: invalid snapshot, starting with empty swap\n", path);
+    while(saved_images != NULL) freeImage(takeImage(saved_images->token));
+    memset(blocks.arr, 0, blocks.total_blocks * sizeof(bool));
+    blocks.free_blocks = blocks.total_blocks;
+    blocks.committed = 0;
+}
+
 void pager_init(int nframes, int nblocks){   
     frames.total_frames = nframes;
     frames.free_frames = nframes;
     blocks.total_blocks = nblocks;
     blocks.free_blocks = nblocks;
-    page_table.head = NULL;
-    page_table.tail = NULL;
-    page_table.ptr = NULL;
+    blocks.committed = 0;
+    page_table.frames = (struct table_entry**)calloc(nframes, sizeof(struct table_entry*));
+    page_table.ptr = 0;
     pthread_mutex_init(&page_table.mutex, NULL);
 
     plist.head = NULL;
     plist.tail = NULL;
     plist.num_process = 0;
     pthread_mutex_init(&plist.mutex, NULL);
-    frames.arr = (bool*)malloc(nframes * sizeof(bool));
-    blocks.arr = (bool*)malloc(nblocks * sizeof(bool));
+
+    entry_cache = slab_cache_create(sizeof(struct table_entry), PAGES_PER_CHUNK);
+    page_cache = slab_cache_create(sizeof(struct p_pages_node), PAGES_PER_CHUNK);
+    proc_cache = slab_cache_create(sizeof(struct plist_node), PROCS_PER_CHUNK);
+    slab_arena_init(&plist.arena, proc_cache);
+    const char* sink_spec = getenv("MMU_SYSLOG_SINK");
+    if(sink_spec == NULL) sink_spec = "stdout";
+    syslog_sink = sink_open(sink_spec);
+    if(syslog_sink == NULL)
+    {
+        perror("MMU_SYSLOG_SINK");
+        syslog_sink = sink_open("stdout");
+    }
+    atexit(closeSyslogSink);
+    const char* source = getenv("MMU_SYSLOG_SOURCE");
+    syslog_source = SYSLOG_SOURCE_FAULT;
+    if(source != NULL && strcmp(source, "swap") == 0) syslog_source = SYSLOG_SOURCE_SWAP;
+    const char* mode = getenv("MMU_OVERCOMMIT");
+    overcommit = OVERCOMMIT_STRICT;
+    if(mode != NULL && strcmp(mode, "heuristic") == 0) overcommit = OVERCOMMIT_HEURISTIC;
+    if(mode != NULL && strcmp(mode, "always") == 0) overcommit = OVERCOMMIT_ALWAYS;
+    const char* compact = getenv("MMU_SWAP_COMPACT");
+    compact_budget = compact != NULL ? atoi(compact) : 0;
+    if(compact_budget < 0) compact_budget = 0;
+    const char* batch = getenv("MMU_RECLAIM_BATCH");
+    reclaim_batch = batch != NULL ? atoi(batch) : 1;
+    // Keep at least half of memory resident across a reclaim
+    if(reclaim_batch > nframes / 2) reclaim_batch = nframes / 2;
+    const char* ahead = getenv("MMU_READAHEAD");
+    readahead = ahead != NULL ? atoi(ahead) : READAHEAD_DEFAULT;
+    if(readahead < 1) readahead = 1;
+    memset(zero_page, '0', PAGE_SIZE);
+
+    frames.arr = (bool*)calloc(nframes, sizeof(bool));
+    blocks.arr = (bool*)calloc(nblocks, sizeof(bool));
     pthread_mutex_init(&frames.mutex, NULL);
     pthread_mutex_init(&blocks.mutex, NULL);
+
+    saved_images = NULL;
+    persist_dir = getenv("MMU_PERSIST");
+    if(persist_dir != NULL) loadSnapshot();
 }
 
 void pager_create(pid_t pid){
-    pthread_mutex_lock(&plist.mutex);
+    lockMutex(&plist.mutex);
     struct plist_node* h = plist.head;
-    struct plist_node* new = (struct plist_node*)malloc(sizeof(struct plist_node));
+    struct plist_node* new = (struct plist_node*)slab_alloc(&plist.arena);
     new->n_pages = 0;
+    new->token[0] = '\0';
     new->next = NULL;
-    new->p_pages = NULL;
+    new->p_pages.head = NULL;
+    new->p_pages.tail = NULL;
+    slab_arena_init(&new->pages_arena, page_cache);
+    slab_arena_init(&new->entries_arena, entry_cache);
     new->pid = pid;
 
     if(h == NULL)
@@ -240,314 +927,359 @@ void pager_create(pid_t pid){
 }
 
 
+int pager_attach(pid_t pid, const char *token){
+    lockMutex(&plist.mutex);
+    struct plist_node* currProcess = getProcess(pid);
+    if(currProcess == NULL || token[0] == '\0' || persist_dir == NULL)
+    {
+        pthread_mutex_unlock(&plist.mutex);
+        return 0;
+    }
+    strncpy(currProcess->token, token, PAGER_TOKEN_MAX - 1);
+    currProcess->token[PAGER_TOKEN_MAX - 1] = '\0';
+    struct saved_image* image = takeImage(currProcess->token);
+    // Only a process with no pages yet can take the image over
+    if(image == NULL || currProcess->n_pages != 0)
+    {
+        if(image != NULL)
+        {
+            image->next = saved_images;
+            saved_images = image;
+        }
+        pthread_mutex_unlock(&plist.mutex);
+        return 0;
+    }
+    // Pages come back lazily: written ones are read from their block on
+    // the first fault, the others are zero-filled
+    struct p_pages* my_proc_pages = &currProcess->p_pages;
+    for(int i = 0; i < image->n_pages; i++)
+    {
+        struct p_pages_node* new_page = (struct p_pages_node*)slab_alloc(&currProcess->pages_arena);
+        new_page->disc_block = image->blocks[i];
+        new_page->used = image->on_disk[i];
+        new_page->entry = NULL;
+        new_page->next = NULL;
+        if(new_page->used)
+        {
+            struct table_entry* entry = (struct table_entry*)slab_alloc(&currProcess->entries_arena);
+            entry->page_number = i;
+            entry->in_mem = 0;
+            entry->wrote = 0;
+            entry->on_disk = 1;
+            entry->frame = -1;
+            entry->prot = PROT_NONE;
+            entry->disk_block = image->blocks[i];
+            entry->pid = pid;
+            new_page->entry = entry;
+        }
+        if(my_proc_pages->tail == NULL) my_proc_pages->head = new_page;
+        else my_proc_pages->tail->next = new_page;
+        my_proc_pages->tail = new_page;
+    }
+    currProcess->n_pages = image->n_pages;
+    int n_pages = image->n_pages;
+    freeImage(image);
+    pthread_mutex_unlock(&plist.mutex);
+    return n_pages;
+}
+
 void *pager_extend(pid_t pid){
-    // Allocate block to new page
-    int block;
-    pthread_mutex_lock(&blocks.mutex);
-    if(blocks.free_blocks) block = getFreeBlock();
-    else return NULL;
-    allocateDiskBlock(block);
-    pthread_mutex_unlock(&blocks.mutex);
-    
-    pthread_mutex_lock(&plist.mutex);
-    // Locate process in process list
-    struct plist_node* currProcess = plist.head; 
-    for(int i = 0; i < plist.num_process; i++, currProcess = currProcess->next) if(currProcess->pid == pid) break;    
-    currProcess->n_pages++;
-    int pageNumber = currProcess->n_pages - 1;
-
-    //Check if the process page list was already declared
-    if(currProcess->p_pages == NULL)currProcess->p_pages = (struct p_pages*)malloc(sizeof(struct p_pages));
-    struct p_pages* my_proc_pages = currProcess->p_pages;
-    
-    //Set new page to add to the process page list
-    struct p_pages_node* new_page = (struct p_pages_node*)malloc(sizeof(struct p_pages_node));
-    new_page->disc_block = block;
-    new_page->entry = NULL;
-    new_page->next = NULL;
-    // Check whether its the first page of the process
-    if(pageNumber == 0)
-    {
-        my_proc_pages->head = new_page;
-        my_proc_pages->tail = my_proc_pages->head;
+    int count;
+    return pager_extend_run(pid, 1, &count);
+}
+
+void *pager_extend_run(pid_t pid, int npages, int *count){
+    lockMutex(&plist.mutex);
+    struct plist_node* currProcess = getProcess(pid);
+    *count = 0;
+    if(currProcess == NULL || npages <= 0)
+    {
+        pthread_mutex_unlock(&plist.mutex);
+        return NULL;
+    }
+    if(npages > MAX_PROC_PAGES - currProcess->n_pages) npages = MAX_PROC_PAGES - currProcess->n_pages;
+
+    // Commit the new pages; in strict mode each gets a disk block now, in
+    // one pass over the blocks array, otherwise blocks are allocated when
+    // dirty pages are evicted
+    int block[npages];
+    int n = 0;
+    lockMutex(&blocks.mutex);
+    if(overcommit == OVERCOMMIT_STRICT)
+    {
+        // Keep the new pages contiguous with the process's last page
+        int prev = -1;
+        if(currProcess->p_pages.tail != NULL) prev = *pageBlock(currProcess->p_pages.tail);
+        for(; n < npages && blocks.free_blocks; n++)
+        {
+            block[n] = pickBlock(prev, npages - n);
+            allocateDiskBlock(block[n]);
+            prev = block[n];
+        }
     }
     else
     {
-        struct p_pages_node* old_tail = my_proc_pages->tail;
-        old_tail->next = new_page;
+        n = npages;
+        int limit = frames.total_frames + blocks.total_blocks - blocks.committed;
+        if(overcommit == OVERCOMMIT_HEURISTIC && n > limit) n = limit < 0 ? 0 : limit;
+        for(int i = 0; i < n; i++) block[i] = -1;
+    }
+    blocks.committed += n;
+    pthread_mutex_unlock(&blocks.mutex);
+    if(n == 0)
+    {
+        pthread_mutex_unlock(&plist.mutex);
+        return NULL;
+    }
+
+    int firstPage = currProcess->n_pages;
+    struct p_pages* my_proc_pages = &currProcess->p_pages;
+    for(int i = 0; i < n; i++)
+    {
+        //Set new page to add to the process page list
+        struct p_pages_node* new_page = (struct p_pages_node*)slab_alloc(&currProcess->pages_arena);
+        new_page->disc_block = block[i];
+        new_page->used = 0;
+        new_page->entry = NULL;
+        new_page->next = NULL;
+        // Check whether its the first page of the process
+        if(my_proc_pages->tail == NULL) my_proc_pages->head = new_page;
+        else my_proc_pages->tail->next = new_page;
         my_proc_pages->tail = new_page;
     }
+    currProcess->n_pages += n;
     pthread_mutex_unlock(&plist.mutex);
-    return (void*)getVAddr(pageNumber);
+    *count = n;
+    return (void*)getVAddr(firstPage);
 }
 
-void pager_fault(pid_t pid, void *addr){
-    pthread_mutex_lock(&plist.mutex);
+int pager_fault(pid_t pid, void *addr){
+    lockMutex(&plist.mutex);
     // Locate process in process list
     struct plist_node* currProcess = plist.head; 
     for(int i = 0; i < plist.num_process; i++, currProcess = currProcess->next) if(currProcess->pid == pid) break;
     // Get page number from the virtual address
-    intptr_t page_number = ((intptr_t)addr - UVM_BASEADDR) /  0x1000;
-    struct p_pages_node* currPage = currProcess->p_pages->head;
-    // Go to the right page
-    for(int i = 0; i < page_number; i++, currPage = currPage->next);
-
-    //If the zero-fill wasnt perfomed yet, alocate memory for the page and change permissions
-    int used = currPage->used;
-    pthread_mutex_lock(&page_table.mutex);
-    // First use memory
-    if(!used)
-    {
-        pthread_mutex_lock(&frames.mutex);
-        int frame = getFreeFrame();
-        if(frame != -1)
-        {
-            allocateFrame(frame);
-        }
-        // All frames in use, perform second chance algorithm
-        else
-        {
-            // Unsuded page go to disk
-            struct table_entry* dead_entry = getUnusedPage();
-            frame = dead_entry->frame;
-            int block = dead_entry->disk_block;
-            dead_entry->in_mem = 0;
-            void* _addr =  (void*)getVAddr(dead_entry->page_number); 
-            mmu_nonresident(pid, _addr);
-            if(dead_entry->wrote)mmu_disk_write(frame, block);
-        }
-        struct table_entry* new_entry = (struct table_entry*)malloc(sizeof(struct table_entry));
-        currPage->entry = new_entry;
-        new_entry->frame = frame;
-        new_entry->disk_block = currPage->disc_block;
-        new_entry->next = NULL;
-        new_entry->page_number = page_number;
-        new_entry->prot = PROT_READ;
-        new_entry->pid = pid;
-        new_entry->in_mem = 1;
-        new_entry->wrote = 0;
-        // Append entry to the table
-        if(page_table.head == NULL )
-        {
-            page_table.head = new_entry;
-            page_table.tail = page_table.head;
-            currPage->previous_entry = NULL;
-        }
-        else
-        {
-            struct table_entry* old_tail = page_table.tail;
-            old_tail->next = new_entry;
-            page_table.tail = new_entry;
-            currPage->previous_entry = old_tail;
-        }
-        mmu_zero_fill(frame);
-        currPage->used = 1;
-        void* _addr = (void*)((intptr_t)addr);
-        mmu_resident(pid, _addr, frame, PROT_READ);
-        pthread_mutex_unlock(&frames.mutex);
-    }
-    // Memory already used
-    else
+    intptr_t page_number = ((intptr_t)addr - UVM_BASEADDR) / PAGE_SIZE;
+    struct p_pages_node* currPage = getPage(currProcess, page_number);
+
+    int ret = 0;
+    lockMutex(&page_table.mutex);
+    struct table_entry* currEntry = currPage->entry;
+    // Write access to a readable page
+    if(currPage->used && currEntry->in_mem && currEntry->prot != PROT_NONE)
     {
-        int in_mem = currPage->entry->in_mem;
-        if(in_mem)
+        // With overcommit, the disk copy of a written page is stale and
+        // its block can go to another page until this one is evicted
+        if(overcommit != OVERCOMMIT_STRICT && currEntry->disk_block != -1)
         {
-            currPage->entry->wrote = 1;
-            currPage->entry->prot = PROT_READ | PROT_WRITE;
-            void* _addr = (void*)((intptr_t)addr);
-            mmu_chprot(pid, _addr, PROT_READ | PROT_WRITE);
-        }
-        else
-        {
-            // Unsuded page go to disk
-            struct table_entry* currEntry = currPage->entry;
-            struct table_entry* dead_entry = getUnusedPage();
-            int frame = dead_entry->frame;
-            int dead_block = dead_entry->disk_block;
-            dead_entry->in_mem = 0;
-            void* _addr =  (void*)getVAddr(dead_entry->page_number); 
-            mmu_nonresident(pid, _addr);
-            // Check whether the swapped pages wrote on memory
-            if(dead_entry->wrote) mmu_disk_write(frame, dead_block);
-            if(currEntry->wrote)mmu_disk_read(currEntry->disk_block, frame);
-            else mmu_zero_fill(frame);
-            // Update curr entry status
-            currEntry->frame = frame;
-            currEntry->in_mem = 1;
-            currEntry->prot = 1;
-            // Set mmu_resident parameters
-            frame = currEntry->frame;
-            int prot = currEntry->prot;
-            _addr = (void*)getVAddr(currEntry->page_number);
-            intptr_t pid = currEntry->pid;
-            mmu_resident(pid, _addr, frame, prot);
+            lockMutex(&blocks.mutex);
+            freeDiskBlock(currEntry->disk_block);
+            pthread_mutex_unlock(&blocks.mutex);
+            currEntry->disk_block = -1;
+            currEntry->on_disk = 0;
         }
+        currEntry->wrote = 1;
+        currEntry->prot = PROT_READ | PROT_WRITE;
+        mmu_chprot(pid, (void*)getVAddr(page_number), currEntry->prot);
+        stats_add(STATS_FAULT_PROT, 1);
     }
-    pthread_mutex_unlock(&plist.mutex);
+    else ret = readAccess(currProcess, currPage, page_number);
     pthread_mutex_unlock(&page_table.mutex);
+    pthread_mutex_unlock(&plist.mutex);
+    return ret;
 }
 
 int pager_syslog(pid_t pid, void *addr, size_t len){
-    pthread_mutex_lock(&page_table.mutex);
-    pthread_mutex_lock(&plist.mutex);
-    struct plist_node* currProcess = plist.head;
-    for(int i = 0; i < plist.num_process; i++, currProcess = currProcess->next) if(currProcess->pid == pid) break;    
-    
-    int pageNumber = currProcess->n_pages;
-    intptr_t rem_bytes = 0;
-    if(len * 8 > 0x1000)rem_bytes = (intptr_t)(len * 8) % 0x1000;
-    intptr_t offset_bytes = ((intptr_t)addr - UVM_BASEADDR) % 0x1000; 
-    intptr_t offset_pages = ((intptr_t)addr - UVM_BASEADDR) / ((intptr_t)0x1000);
-    intptr_t num_pages_write = len / 4;
-
-	if (pageNumber == 0) {
-        pthread_mutex_unlock(&page_table.mutex);
-		pthread_mutex_unlock(&plist.mutex);
-		return -1;
-	}
-    else {
-        intptr_t end_addr_req  =  (intptr_t)addr + (intptr_t)len * 8;
-        intptr_t end_addr_real  =  UVM_BASEADDR + (intptr_t)(0x1000 * (intptr_t)pageNumber);
-
-        if(end_addr_req > end_addr_real || (intptr_t)addr < UVM_BASEADDR) {
+    lockMutex(&plist.mutex);
+    struct plist_node* currProcess = getProcess(pid);
+
+    // The whole range must lie in pages allocated to the process
+    intptr_t start = (intptr_t)addr - UVM_BASEADDR;
+    intptr_t allocated = currProcess->n_pages * PAGE_SIZE;
+    if(currProcess->n_pages == 0 || start < 0 || start >= allocated || len > (size_t)(allocated - start))
+    {
+        pthread_mutex_unlock(&plist.mutex);
+        errno = EINVAL;
+        return -1;
+    }
+    char* buf = getSyslogBuffer(2 * SYSLOG_CHUNK);
+    if(buf == NULL)
+    {
+        pthread_mutex_unlock(&plist.mutex);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Encode each piece straight from where the page lives, handing
+    // the output to the sink one chunk at a time
+    lockMutex(&page_table.mutex);
+    size_t used = 0;
+    // Set if memory runs out while paging in the range
+    bool failed = false;
+    struct page_span span;
+    spanInit(&span, currProcess, start, len);
+    while(!failed && spanNext(&span))
+    {
+        const char* src = syslogSource(currProcess, span.page, span.page_number);
+        failed = src == NULL;
+        if(failed) break;
+        src += span.offset;
+        size_t done = 0;
+        while(done < span.len)
+        {
+            size_t n = span.len - done;
+            if(n > SYSLOG_CHUNK - used) n = SYSLOG_CHUNK - used;
+            hex_encode(buf + 2 * used, src + done, n);
+            used += n;
+            done += n;
+            if(used < SYSLOG_CHUNK) continue;
+            // Do not hold the pager locks while writing
             pthread_mutex_unlock(&page_table.mutex);
             pthread_mutex_unlock(&plist.mutex);
-            return -1;
+            syslogFlush(buf, 2 * used, false);
+            used = 0;
+            lockMutex(&plist.mutex);
+            lockMutex(&page_table.mutex);
+            // The process may have been destroyed in the meantime
+            if(getProcess(pid) != currProcess)
+            {
+                pthread_mutex_unlock(&page_table.mutex);
+                pthread_mutex_unlock(&plist.mutex);
+                syslogFlush(buf, 0, true);
+                errno = EINVAL;
+                return -1;
+            }
+            // The page may have been evicted while unlocked
+            src = syslogSource(currProcess, span.page, span.page_number);
+            failed = src == NULL;
+            if(failed) break;
+            src += span.offset;
         }
-        // else if(len > 4096) {
-        //     pthread_mutex_unlock(&page_table.mutex);
-        //     pthread_mutex_unlock(&plist.mutex);
-        //     return -1;
-        // }
-    }
-    char* buf = (char *)malloc(len * sizeof(char));
-    struct p_pages_node* currPage = currProcess->p_pages->head; 
-    // Go to initial page to write
-    for(int i = 0; i < offset_pages; i++, currPage = currPage->next);
-    int frame = currPage->entry->frame;
-    for(intptr_t i = 0; i < num_pages_write; i++, currPage = currPage->next)
-    {
-        frame = currPage->entry->frame;
-        // If is the first frame, add offset bytes
-        if(i == 0)for(int j = offset_bytes; j < len && j < 0x1000; j++)buf[j] = pmem[frame + j];
-        // In middle frames, get the full page
-        else for(int j = 0; j < len && j < 0x1000; j++)buf[j] = pmem[frame + j];
-    }
-    // get the remaining bytes
-    if(rem_bytes)
-    {
-        frame = currPage->entry->frame;
-        for(int i = 0; i < rem_bytes; i++)buf[i] = pmem[frame + i];
-    }
-    // Print buffer
-    for(int i = 0; i < len; i++) printf("%02x", (unsigned)buf[i]);
-    printf("\n");
+    }
     pthread_mutex_unlock(&page_table.mutex);
     pthread_mutex_unlock(&plist.mutex);
+    syslogFlush(buf, 2 * used, true);
+    if(failed)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
     return 0;
-    
 }
 
 void pager_destroy(pid_t pid){
-    pthread_mutex_lock(&plist.mutex);
-    if (plist.num_process == 0) goto end;
+    lockMutex(&plist.mutex);
     // Locate process in process list and mantain the proces right before
     struct plist_node* currProcess = plist.head;
     struct plist_node* prevProcess = NULL;
-    for(int i = 0; i < plist.num_process; i++)
+    while(currProcess != NULL && currProcess->pid != pid)
     {
-        if(currProcess->pid == pid) break;
-        prevProcess=currProcess;
+        prevProcess = currProcess;
         currProcess = currProcess->next;
-        
     }
-    // Whether the process has allocated pages, remove it
-    if(currProcess->p_pages != NULL)
+    if(currProcess == NULL)
     {
-        struct p_pages_node* currPage = currProcess->p_pages->head;
-        // Remove all nodes except head
-        while(currPage->next != NULL)
-        {
-            struct p_pages_node* toRemove = currPage->next;
-            currPage->next = toRemove->next;
-            // Remove from page table
-            pthread_mutex_lock(&page_table.mutex);
-            struct table_entry* prev = toRemove->previous_entry;
-            struct table_entry* curr = toRemove->entry;
-            if(curr != NULL)
-            {
-                struct table_entry* next = toRemove->entry->next;
-                int frame = curr->frame;
-                int block = curr->disk_block;
-                // If you are removing the head of the page table, update head
-                if(prev == NULL) page_table.head = next;
-                else prev->next = next;
-                free(curr);
-                pthread_mutex_unlock(&page_table.mutex);
-                // Remove from process page table
-                free(toRemove);
-                // Free resources
-                pthread_mutex_lock(&blocks.mutex);
-                freeDiskBlock(block);
-                pthread_mutex_unlock(&blocks.mutex);
-                pthread_mutex_lock(&frames.mutex);
-                freeMemoryFrame(frame);
-                pthread_mutex_unlock(&frames.mutex);
-            }
-            else
-            {
-                int block = currPage->disc_block;
-                pthread_mutex_lock(&blocks.mutex);
-                freeDiskBlock(block);
-                pthread_mutex_unlock(&blocks.mutex);
-            }
-        }
-    
-        // Remove head node
-        struct p_pages_node* toRemove = currPage;
-        struct table_entry* prev = toRemove->previous_entry;
-        struct table_entry* curr = toRemove->entry;
-        // Check if the page realy was in the page table
-        if(curr != NULL)
-        {
-            int frame = curr->frame;
-            int block = curr->disk_block;
-            struct table_entry* next = toRemove->entry->next;
-            // If you are removing the head of the page table, update head
-            if(prev == NULL) page_table.head = next;
-            else prev->next = next;
-            free(curr);
-            pthread_mutex_unlock(&page_table.mutex);
-            // Remove from process page table
-            free(toRemove);
-            // Free resources
-            pthread_mutex_lock(&blocks.mutex);
-            freeDiskBlock(block);
-            pthread_mutex_unlock(&blocks.mutex);
-            pthread_mutex_lock(&frames.mutex);
-            freeMemoryFrame(frame);
-        }
-        // If the page wasnt in the page table, only the block was reserved
-        else
+        pthread_mutex_unlock(&plist.mutex);
+        return;
+    }
+
+    // Collect the frames and blocks owned by the process in a single pass
+    int dead_frames[MAX_PROC_PAGES];
+    int dead_blocks[MAX_PROC_PAGES];
+    int n_frames = 0;
+    int n_blocks = 0;
+    lockMutex(&page_table.mutex);
+    // Processes with a token keep their blocks when swap is persistent;
+    // without an image to record them in, the blocks are freed instead
+    bool keep = persist_dir != NULL && currProcess->token[0] != '\0';
+    if(keep) keep = saveImage(currProcess);
+    for(struct p_pages_node* currPage = currProcess->p_pages.head; currPage != NULL; currPage = currPage->next)
+    {
+        // Blocks of overcommitted pages are only allocated on eviction
+        int block = *pageBlock(currPage);
+        if(block != -1 && !keep) dead_blocks[n_blocks++] = block;
+        if(currPage->used && currPage->entry->in_mem)
         {
-            int block = currPage->disc_block;
-            pthread_mutex_lock(&blocks.mutex);
-            freeDiskBlock(block);
-            pthread_mutex_unlock(&blocks.mutex);
+            // Remove the page from the clock
+            page_table.frames[currPage->entry->frame] = NULL;
+            dead_frames[n_frames++] = currPage->entry->frame;
         }
     }
+    // Return frames before releasing the page table so the clock never
+    // sees a frame that is neither free nor owned by a page
+    lockMutex(&frames.mutex);
+    for(int i = 0; i < n_frames; i++) freeMemoryFrame(dead_frames[i]);
+    pthread_mutex_unlock(&frames.mutex);
+    pthread_mutex_unlock(&page_table.mutex);
+
+    lockMutex(&blocks.mutex);
+    for(int i = 0; i < n_blocks; i++) freeDiskBlock(dead_blocks[i]);
+    if(!keep) blocks.committed -= currProcess->n_pages;
+    pthread_mutex_unlock(&blocks.mutex);
+
     // Remove the process block from the process list
     if(prevProcess == NULL) plist.head = currProcess->next;
     else prevProcess->next = currProcess->next;
-    free(currProcess->p_pages);
-    free(currProcess);
+    if(plist.tail == currProcess) plist.tail = prevProcess;
+    // Page nodes and entries are released with the process arenas
+    slab_arena_release(&currProcess->pages_arena);
+    slab_arena_release(&currProcess->entries_arena);
+    slab_free(&plist.arena, currProcess);
     plist.num_process--;
-    end:
+    // Freed blocks leave holes in the other processes' runs
+    if(compact_budget) compactSwap(compact_budget);
     pthread_mutex_unlock(&plist.mutex);
-    // Whether has no more processes, dealocate resources
-    if(plist.num_process == 0)
+}
+
+void pager_save(void){
+    if(persist_dir == NULL) return;
+    lockMutex(&plist.mutex);
+    char path[PATH_MAX];
+    char tmp[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", persist_dir, SNAPSHOT_FILE);
+    if(snprintf(tmp, sizeof(tmp), "%s/%s.tmp", persist_dir, SNAPSHOT_FILE) >= (int)sizeof(tmp))
+    {
+        fprintf(stderr, "%s: path too long, not saving swap\n", persist_dir);
+        pthread_mutex_unlock(&plist.mutex);
+        return;
+    }
+    FILE* file = fopen(tmp, "wb");
+    if(file == NULL)
+    {
+        perror(tmp);
+        pthread_mutex_unlock(&plist.mutex);
+        return;
+    }
+    int32_t header[2] = {blocks.total_blocks, 0};
+    for(struct saved_image* image = saved_images; image != NULL; image = image->next) header[1]++;
+    bool ok = fwrite(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC) - 1, 1, file) == 1 && fwrite(header, sizeof(header), 1, file) == 1;
+    for(struct saved_image* image = saved_images; ok && image != NULL; image = image->next)
+    {
+        int32_t n_pages = image->n_pages;
+        ok = fwrite(image->token, PAGER_TOKEN_MAX, 1, file) == 1 && fwrite(&n_pages, sizeof(n_pages), 1, file) == 1;
+        for(int i = 0; ok && i < image->n_pages; i++)
+        {
+            int32_t block = image->blocks[i];
+            ok = fwrite(&block, sizeof(block), 1, file) == 1 && fwrite(&image->on_disk[i], sizeof(bool), 1, file) == 1;
+        }
+    }
+    // Replace the old snapshot only once the new one is complete
+    if(fclose(file) != 0) ok = false;
+    if(!ok || rename(tmp, path) != 0)
     {
-        free(frames.arr);
-        free(blocks.arr);
+        perror(path);
+        unlink(tmp);
     }
-}
\ No newline at end of file
+    pthread_mutex_unlock(&plist.mutex);
+}
+
+void pager_free(void){
+    while(saved_images != NULL) freeImage(takeImage(saved_images->token));
+    free(page_table.frames);
+    free(frames.arr);
+    free(blocks.arr);
+    slab_arena_release(&plist.arena);
+    slab_cache_destroy(entry_cache);
+    slab_cache_destroy(page_cache);
+    slab_cache_destroy(proc_cache);
+}
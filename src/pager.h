@@ -17,6 +17,19 @@ void pager_init(int nframes, int nblocks);
  * manage memory for a new process `pid`. */
 void pager_create(pid_t pid);
 
+/* `PAGER_TOKEN_MAX` bounds the length of the tokens passed to
+ * `pager_attach`, including the terminating NUL. */
+#define PAGER_TOKEN_MAX 32
+
+/* `pager_attach` is called after `pager_create` when process `pid`
+ * identifies itself with `token`.  When the MMU_PERSIST environment
+ * variable names a directory, the pages of processes with a token
+ * stay in swap after they exit (and across MMU restarts, see
+ * `pager_save`); a later process with the same token and no pages
+ * gets them back, and they are paged in lazily on first access.
+ * Returns the number of pages given back to `pid`. */
+int pager_attach(pid_t pid, const char *token);
+
 /* `pager_extend` allocates a new page of memory to process `pid`
  * and returns a pointer to that memory in the process's address
  * space.  `pager_extend` need not zero memory or install mappings
@@ -25,6 +38,20 @@ void pager_create(pid_t pid);
  * `pager_extend` should return NULL is there are no disk blocks to
  * use as backing storage. */
 void *pager_extend(pid_t pid);
+/* The pager reserves disk blocks according to the MMU_OVERCOMMIT
+ * environment variable.  In "strict" mode (the default) each page
+ * gets its disk block in `pager_extend`.  In "heuristic" and
+ * "always" modes blocks are allocated when dirty pages are first
+ * paged out; "heuristic" refuses to allocate more pages than there
+ * are frames and blocks, and "always" never refuses. */
+
+/* `pager_extend_run` allocates up to `npages` consecutive pages to
+ * process `pid`, reserving their disk blocks in a single pass, and
+ * returns the address of the first page.  The number of pages
+ * allocated is stored in `count`; it is smaller than `npages` if
+ * there are not enough disk blocks.  Returns NULL and stores 0 in
+ * `count` if no page could be allocated. */
+void *pager_extend_run(pid_t pid, int npages, int *count);
 
 /* `pager_fault` is called when process `pid` receives
  * a segmentation fault at address `addr`.  `pager_fault` is only
@@ -37,8 +64,20 @@ void *pager_extend(pid_t pid);
  * accesses the same (i.e., do not prioritize either).  As the
  * memory management infrastructure does not maintain page access
  * and writing information, your pager must track this information
- * to implement the second-chance algorithm. */
-void pager_fault(pid_t pid, void *addr);
+ * to implement the second-chance algorithm.  Dirty pages that have
+ * no disk block and cannot get one are skipped by the
+ * second-chance algorithm; if no page can be paged out,
+ * `pager_fault` returns -1 and sets errno to ENOMEM.  Returns 0 on
+ * success. */
+int pager_fault(pid_t pid, void *addr);
+/* Setting the MMU_READAHEAD environment variable above 1 enables
+ * readahead: when a page is read back from disk, up to
+ * MMU_READAHEAD - 1 following pages of the process whose data sits
+ * in the following blocks are read into the frames after the
+ * faulting page's frame, as long as those are free, and all of them
+ * are mapped with a single `mmu_resident_run`.  Those frames need
+ * not be the lowest-numbered free ones.  Readahead is off by
+ * default. */
 
 /* `pager_syslog prints a message made of `len` bytes following
  * `addr` in the address space of process `pid`.  `pager_syslog`
@@ -46,13 +85,26 @@ void pager_fault(pid_t pid, void *addr);
  * (zeroing and swapping in pages from disk if necessary).  If the
  * processes tries to syslog a memory region it has not allocated,
  * then `pager_syslog` should return -1 and set errno to EINVAL; if
- * the syslog succeeds, it should return 0. */
+ * memory runs out while paging in the region, it should return -1
+ * and set errno to ENOMEM; if the syslog succeeds, it should return
+ * 0. */
 int pager_syslog(pid_t pid, void *addr, size_t len);
 
 /* `pager_destroy` is called when the process is already dead.  It
  * should free all resources process `pid` allocated (memory frames
- * and disk blocks).  `pager_destroy` should not call any of the MMU
- * functions. */
+ * and disk blocks).  `pager_destroy` should not call the MMU
+ * functions that change a process's mappings (`mmu_resident`,
+ * `mmu_nonresident`, `mmu_chprot` and the like); it may only use
+ * the disk functions.  With MMU_PERSIST set, it writes the dirty
+ * resident pages of processes with a token back to their disk
+ * blocks with `mmu_disk_write`; with MMU_SWAP_COMPACT set, it moves
+ * the blocks of the remaining processes with `mmu_disk_move`. */
 void pager_destroy(pid_t pid);
 
+/* `pager_save` is called when the MMU shuts down, after all
+ * processes are destroyed.  With MMU_PERSIST set, it writes the
+ * pages kept for exited processes to a snapshot in that directory,
+ * which `pager_init` reads back. */
+void pager_save(void);
+
 #endif
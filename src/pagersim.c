@@ -0,0 +1,791 @@
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "capture.h"
+#include "mmu.h"
+#include "pager.h"
+
+/* This program replays a page access trace through the pager, linked against
+ * a mock of the MMU, and through reference replacement policies simulated
+ * with the same number of frames.  It runs without processes, sockets or
+ * disk, so changes to the pager can be measured in isolation.
+ *
+ * The trace is either a text file (see =sim_load_text=), a list of captures
+ * of uvm clients separated by commas (see =sim_load_captures=), or a
+ * synthetic workload named by a specification "NAME[:KEY=VALUE,...]" (see
+ * =sim_generate=).  The pager is configured by the same environment
+ * variables as the MMU. */
+
+/*****************************************************************************
+ * static variables and function declarations
+ ****************************************************************************/
+#define SIM_MAX_PROCS 64
+#define SIM_MAX_PAGES ((UVM_MAXADDR - UVM_BASEADDR + 1) / SIM_PAGE_SIZE)
+#define SIM_PAGE_SIZE ((intptr_t)0x1000)
+#define SIM_NKEYS (SIM_MAX_PROCS * SIM_MAX_PAGES)
+
+/* trace operations; =arg= is the page accessed or the number of pages */
+#define SIM_CREATE 0
+#define SIM_EXTEND 1
+#define SIM_READ 2
+#define SIM_WRITE 3
+#define SIM_DESTROY 4
+
+#define SIM_POLICY_PAGER 0
+#define SIM_POLICY_FIFO 1
+#define SIM_POLICY_LRU 2
+#define SIM_POLICY_OPT 3
+#define SIM_NPOLICIES 4
+
+#define SIM_GEN_SEQ 0
+#define SIM_GEN_ZIPF 1
+#define SIM_GEN_LOOP 2
+#define SIM_GEN_MIXED 3
+
+struct sim_op {
+	uint8_t op;
+	uint8_t pid;
+	uint16_t arg;
+};
+
+/* an operation of a capture, with the time it happened */
+struct sim_event {
+	uint64_t time;
+	uint32_t seq;
+	/* the capture's index */
+	uint32_t proc;
+	uint16_t arg;
+	uint8_t op;
+};
+
+struct sim_trace {
+	struct sim_op *ops;
+	size_t n;
+	size_t cap;
+	size_t naccesses;
+	int nprocs;
+};
+
+/* parameters of synthetic workloads */
+struct sim_gen {
+	int kind;
+	int procs;
+	int pages;
+	long n;
+	int write;
+	uint64_t seed;
+	double theta;
+	int len;
+	int reps;
+	int burst;
+};
+
+struct sim_result {
+	uint64_t faults;
+	uint64_t pageins;
+	uint64_t writebacks;
+	double secs;
+};
+
+/* The MMU as seen by the pager: each page's protection and frame.  Frames
+ * mapped to two pages at once are counted as =conflicts=. */
+struct sim_mmu {
+	uint8_t prot[SIM_MAX_PROCS][SIM_MAX_PAGES];
+	int16_t frame[SIM_MAX_PROCS][SIM_MAX_PAGES];
+	int32_t *owner;
+	int nframes;
+	uint64_t zero_fills;
+	uint64_t disk_reads;
+	uint64_t disk_writes;
+	uint64_t conflicts;
+};
+
+/* Frames of a reference policy.  The victim is the frame with the lowest
+ * =prio=, which holds the load time (FIFO), the last access time (LRU) or
+ * the negated time of the next access (OPT). */
+struct sim_cache {
+	int nframes;
+	int nfree;
+	int32_t *owner;
+	uint64_t *prio;
+	uint8_t *dirty;
+	int32_t where[SIM_NKEYS];
+};
+
+static const char *policy_names[SIM_NPOLICIES] = {"pager", "fifo", "lru",
+		"opt"};
+static const char *gen_names[] = {"seq", "zipf", "loop", "mixed", NULL};
+
+const char *pmem = NULL;
+static struct sim_mmu sim;
+static char sim_block[SIM_PAGE_SIZE];
+
+static void usage(const char *prog);
+static void sim_push(struct sim_trace *t, int op, int pid, int arg);
+static int sim_load(struct sim_trace *t, const char *spec);
+static int sim_load_text(struct sim_trace *t, const char *path);
+static int sim_load_captures(struct sim_trace *t, const char *spec);
+static int sim_read_capture(const char *path, int proc,
+		struct sim_event **ev, size_t *n, size_t *cap);
+static void sim_event_push(struct sim_event **ev, size_t *n, size_t *cap,
+		uint64_t time, uint32_t seq, int op, int proc, int arg);
+static int sim_event_cmp(const void *va, const void *vb);
+static int sim_parse_gen(struct sim_gen *g, const char *spec);
+static void sim_generate(struct sim_trace *t, const struct sim_gen *g);
+static uint64_t sim_rand(uint64_t *state);
+static double sim_now(void);
+static intptr_t sim_page(void *vaddr);
+static void sim_run_pager(const struct sim_trace *t, struct sim_result *r);
+static void sim_run_policy(const struct sim_trace *t, int policy, int nframes,
+		struct sim_result *r);
+
+/*****************************************************************************
+ * public function implementations
+ ****************************************************************************/
+int main(int argc, char **argv) /* {{{ */
+{
+	if(argc != 4 && argc != 5) usage(argv[0]);
+	int nframes = atoi(argv[1]);
+	int nblocks = atoi(argv[2]);
+	if(nframes < 2 || nframes > INT16_MAX || nblocks < 2) usage(argv[0]);
+
+	struct sim_trace t = {NULL, 0, 0, 0, 0};
+	struct sim_gen g;
+	int gen = sim_parse_gen(&g, argv[3]);
+	if(gen == -1) usage(argv[0]);
+	if(gen) sim_generate(&t, &g);
+	else if(sim_load(&t, argv[3])) exit(EXIT_FAILURE);
+
+	int run[SIM_NPOLICIES] = {1, 1, 1, 1};
+	if(argc == 5) {
+		memset(run, 0, sizeof(run));
+		char *list = strdup(argv[4]);
+		char *save = NULL;
+		for(char *name = strtok_r(list, ",", &save); name;
+				name = strtok_r(NULL, ",", &save)) {
+			int i = 0;
+			while(i < SIM_NPOLICIES && strcmp(name, policy_names[i])) i++;
+			if(i == SIM_NPOLICIES) usage(argv[0]);
+			run[i] = 1;
+		}
+		free(list);
+	}
+
+	printf("trace %s: %d processes, %zu accesses, %d frames, %d blocks\n",
+			argv[3], t.nprocs, t.naccesses, nframes, nblocks);
+	printf("%-8s %12s %12s %12s %10s %10s\n", "policy", "faults",
+			"page-ins", "writebacks", "msec", "Macc/s");
+	for(int i = 0; i < SIM_NPOLICIES; ++i) {
+		if(!run[i]) continue;
+		struct sim_result r;
+		if(i == SIM_POLICY_PAGER) {
+			pager_init(nframes, nblocks);
+			sim.nframes = nframes;
+			sim.owner = malloc(nframes * sizeof(*sim.owner));
+			if(!sim.owner) exit(EXIT_FAILURE);
+			for(int f = 0; f < nframes; ++f) sim.owner[f] = -1;
+			sim_run_pager(&t, &r);
+		} else {
+			sim_run_policy(&t, i, nframes, &r);
+		}
+		printf("%-8s %12llu %12llu %12llu %10.1f %10.2f\n", policy_names[i],
+				(unsigned long long)r.faults,
+				(unsigned long long)r.pageins,
+				(unsigned long long)r.writebacks, r.secs * 1e3,
+				r.secs > 0 ? t.naccesses / r.secs / 1e6 : 0);
+	}
+	free(t.ops);
+	if(sim.conflicts) {
+		fprintf(stderr, "pager mapped a frame to two pages %llu times\n",
+				(unsigned long long)sim.conflicts);
+		exit(EXIT_FAILURE);
+	}
+	return 0;
+} /* }}} */
+
+/* The mock MMU applies changes immediately, so batches are no-ops. */
+void mmu_batch_begin(void) { }
+void mmu_batch_end(void) { }
+int mmu_chprot_pending(pid_t pid, void *vaddr) { return 0; }
+
+void mmu_zero_fill(int frame) /* {{{ */
+{
+	sim.zero_fills++;
+} /* }}} */
+
+void mmu_resident(pid_t pid, void *vaddr, int frame, int prot) /* {{{ */
+{
+	intptr_t page = sim_page(vaddr);
+	int32_t key = pid * SIM_MAX_PAGES + page;
+	int32_t old = sim.owner[frame];
+	if(old != -1 && old != key
+			&& sim.frame[old / SIM_MAX_PAGES][old % SIM_MAX_PAGES] == frame)
+		sim.conflicts++;
+	sim.owner[frame] = key;
+	sim.frame[pid][page] = frame;
+	sim.prot[pid][page] = prot;
+} /* }}} */
+
+void mmu_resident_run(pid_t pid, void *vaddr, int frame, int npages, /* {{{ */
+		int prot)
+{
+	for(int i = 0; i < npages; ++i)
+		mmu_resident(pid, (char *)vaddr + i * SIM_PAGE_SIZE, frame + i, prot);
+} /* }}} */
+
+void mmu_nonresident(pid_t pid, void *vaddr) /* {{{ */
+{
+	intptr_t page = sim_page(vaddr);
+	sim.frame[pid][page] = -1;
+	sim.prot[pid][page] = PROT_NONE;
+} /* }}} */
+
+void mmu_chprot(pid_t pid, void *vaddr, int prot) /* {{{ */
+{
+	sim.prot[pid][sim_page(vaddr)] = prot;
+} /* }}} */
+
+void mmu_disk_read(int block_from, int frame_to) /* {{{ */
+{
+	sim.disk_reads++;
+} /* }}} */
+
+void mmu_disk_write(int frame_from, int block_to) /* {{{ */
+{
+	sim.disk_writes++;
+} /* }}} */
+
+void mmu_disk_writev(const int *frames_from, int n, int block_to) /* {{{ */
+{
+	sim.disk_writes += n;
+} /* }}} */
+
+void mmu_disk_move(int block_from, int block_to) { }
+
+const char *mmu_disk_block(int block) /* {{{ */
+{
+	return sim_block;
+} /* }}} */
+
+/*****************************************************************************
+ * static function implementations
+ ****************************************************************************/
+static void usage(const char *prog) /* {{{ */
+{
+	printf("usage: %s NFRAMES NBLOCKS TRACE [POLICY,...]\n", prog);
+	printf("\n");
+	printf("TRACE is a trace file, captures of uvm clients separated by\n");
+	printf("commas, or a workload NAME[:KEY=VALUE,...]:\n");
+	printf("  seq    each process scans its pages in order\n");
+	printf("  zipf   pages chosen with Zipf probabilities (theta)\n");
+	printf("  loop   loops over windows of len pages, reps times each\n");
+	printf("  mixed  processes run seq, zipf and loop in turn\n");
+	printf("keys: procs pages n write(%%) seed theta len reps burst\n");
+	printf("POLICY is one of pager, fifo, lru and opt (default all)\n");
+	exit(EXIT_FAILURE);
+} /* }}} */
+
+static void sim_push(struct sim_trace *t, int op, int pid, int arg) /* {{{ */
+{
+	if(t->n == t->cap) {
+		t->cap = t->cap ? 2 * t->cap : 4096;
+		t->ops = realloc(t->ops, t->cap * sizeof(*t->ops));
+		if(!t->ops) {
+			perror("sim_push");
+			exit(EXIT_FAILURE);
+		}
+	}
+	struct sim_op *o = &t->ops[t->n++];
+	o->op = op;
+	o->pid = pid;
+	o->arg = arg;
+	if(op == SIM_READ || op == SIM_WRITE) t->naccesses++;
+} /* }}} */
+
+static int sim_load(struct sim_trace *t, const char *spec) /* {{{ */
+{
+	char magic[sizeof(CAPTURE_MAGIC) - 1];
+	FILE *file = strchr(spec, ',') || !strcmp(spec, "-") ? NULL
+			: fopen(spec, "rb");
+	int capture = strchr(spec, ',') != NULL;
+	if(file) {
+		capture = fread(magic, sizeof(magic), 1, file) == 1
+				&& !memcmp(magic, CAPTURE_MAGIC, sizeof(magic));
+		fclose(file);
+	}
+	return capture ? sim_load_captures(t, spec) : sim_load_text(t, spec);
+} /* }}} */
+
+static int sim_load_text(struct sim_trace *t, const char *path) /* {{{ */
+{
+	/* One operation per line: "c PID" creates a process, "e PID N"
+	 * extends it by N pages, "r PID PAGE" and "w PID PAGE" read and write
+	 * a page, and "d PID" destroys the process.  PIDs are renumbered in
+	 * order of appearance; lines starting with '#' are ignored. */
+	FILE *file = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if(!file) {
+		perror(path);
+		return -1;
+	}
+	long pids[SIM_MAX_PROCS];
+	int npages[SIM_MAX_PROCS];
+	char line[128];
+	int lineno = 0;
+	while(fgets(line, sizeof(line), file)) {
+		lineno++;
+		char op;
+		long pid;
+		int arg = 0;
+		if(line[0] == '#' || line[0] == '\n') continue;
+		int n = sscanf(line, "%c %ld %d", &op, &pid, &arg);
+		int i = 0;
+		while(i < t->nprocs && pids[i] != pid) i++;
+		if(i == t->nprocs && op == 'c' && n == 2) {
+			/* reuse the number of a destroyed process */
+			i = 0;
+			while(i < t->nprocs && pids[i] != -1) i++;
+			if(i == SIM_MAX_PROCS) goto invalid;
+			if(i == t->nprocs) t->nprocs++;
+			pids[i] = pid;
+			npages[i] = 0;
+			sim_push(t, SIM_CREATE, i, 0);
+			continue;
+		}
+		if(i == t->nprocs || n < 2) goto invalid;
+		if(op == 'e' && n == 3 && arg > 0
+				&& arg <= SIM_MAX_PAGES - npages[i]) {
+			npages[i] += arg;
+			sim_push(t, SIM_EXTEND, i, arg);
+		} else if((op == 'r' || op == 'w') && n == 3 && arg >= 0
+				&& arg < npages[i]) {
+			sim_push(t, op == 'r' ? SIM_READ : SIM_WRITE, i, arg);
+		} else if(op == 'd' && n == 2) {
+			sim_push(t, SIM_DESTROY, i, 0);
+			/* the pid may be created again */
+			pids[i] = -1;
+		} else {
+			goto invalid;
+		}
+	}
+	if(file != stdin) fclose(file);
+	return 0;
+
+	invalid:
+	fprintf(stderr, "%s:%d: invalid operation\n", path, lineno);
+	if(file != stdin) fclose(file);
+	return -1;
+} /* }}} */
+
+static int sim_load_captures(struct sim_trace *t, const char *spec) /* {{{ */
+{
+	/* Each capture is a process.  Captures are merged by the time of
+	 * their sampling periods; accesses within a period keep their order
+	 * but are not interleaved with other processes'.  Processes get the
+	 * number of a process that already exited, if any. */
+	struct sim_event *ev = NULL;
+	size_t n = 0;
+	size_t cap = 0;
+	char *list = strdup(spec);
+	char *save = NULL;
+	int nprocs = 0;
+	int ret = -1;
+	for(char *path = strtok_r(list, ",", &save); path;
+			path = strtok_r(NULL, ",", &save)) {
+		if(sim_read_capture(path, nprocs++, &ev, &n, &cap)) goto out;
+	}
+	int *slot = malloc(nprocs * sizeof(*slot));
+	int used[SIM_MAX_PROCS] = {0};
+	if(!slot) goto out;
+	qsort(ev, n, sizeof(*ev), sim_event_cmp);
+	for(size_t i = 0; i < n; ++i) {
+		if(ev[i].op == SIM_CREATE) {
+			int pid = 0;
+			while(pid < SIM_MAX_PROCS && used[pid]) pid++;
+			if(pid == SIM_MAX_PROCS) {
+				fprintf(stderr, "more than %d processes at once\n",
+						SIM_MAX_PROCS);
+				free(slot);
+				goto out;
+			}
+			used[pid] = 1;
+			slot[ev[i].proc] = pid;
+			if(pid >= t->nprocs) t->nprocs = pid + 1;
+		}
+		sim_push(t, ev[i].op, slot[ev[i].proc], ev[i].arg);
+		if(ev[i].op == SIM_DESTROY) used[slot[ev[i].proc]] = 0;
+	}
+	free(slot);
+	ret = 0;
+
+	out:
+	free(ev);
+	free(list);
+	return ret;
+} /* }}} */
+
+static int sim_read_capture(const char *path, int proc, /* {{{ */
+		struct sim_event **ev, size_t *n, size_t *cap)
+{
+	FILE *file = fopen(path, "rb");
+	if(!file) {
+		perror(path);
+		return -1;
+	}
+	struct capture_header hdr;
+	if(fread(&hdr, sizeof(hdr), 1, file) != 1
+			|| memcmp(hdr.magic, CAPTURE_MAGIC, sizeof(hdr.magic))) {
+		fprintf(stderr, "%s: not a capture\n", path);
+		fclose(file);
+		return -1;
+	}
+	/* captures are compact; read the events at once */
+	size_t len = 0;
+	size_t size = 1<<16;
+	unsigned char *data = malloc(size);
+	size_t r;
+	while(data && (r = fread(data + len, 1, size - len, file)) > 0) {
+		len += r;
+		if(len == size) data = realloc(data, size *= 2);
+	}
+	fclose(file);
+	if(!data) {
+		perror("sim_read_capture");
+		exit(EXIT_FAILURE);
+	}
+
+	uint64_t time = hdr.start;
+	uint32_t seq = 0;
+	int32_t last = 0;
+	int npages = 0;
+	int ok = 1;
+	sim_event_push(ev, n, cap, time, seq++, SIM_CREATE, proc, 0);
+	for(size_t pos = 0; pos < len;) {
+		int kind;
+		int64_t value;
+		size_t c = capture_decode(data + pos, len - pos, &kind, &value,
+				&last);
+		pos += c;
+		if(!c) {
+			ok = 0;
+			break;
+		}
+		if(kind == CAPTURE_TICK) {
+			time += value * hdr.period;
+		} else if(kind == CAPTURE_EXTEND) {
+			if(value < 1 || value > SIM_MAX_PAGES - npages) {
+				ok = 0;
+				break;
+			}
+			npages += value;
+			sim_event_push(ev, n, cap, time, seq++, SIM_EXTEND, proc, value);
+		} else {
+			if(value < 0 || value >= npages) {
+				ok = 0;
+				break;
+			}
+			sim_event_push(ev, n, cap, time, seq++, kind == CAPTURE_WRITE
+					? SIM_WRITE : SIM_READ, proc, value);
+		}
+	}
+	sim_event_push(ev, n, cap, time, seq++, SIM_DESTROY, proc, 0);
+	free(data);
+	if(!ok) fprintf(stderr, "%s: invalid event, capture cut short\n", path);
+	return 0;
+} /* }}} */
+
+static void sim_event_push(struct sim_event **ev, size_t *n, /* {{{ */
+		size_t *cap, uint64_t time, uint32_t seq, int op, int proc, int arg)
+{
+	if(*n == *cap) {
+		*cap = *cap ? 2 * *cap : 4096;
+		*ev = realloc(*ev, *cap * sizeof(**ev));
+		if(!*ev) {
+			perror("sim_event_push");
+			exit(EXIT_FAILURE);
+		}
+	}
+	struct sim_event *e = &(*ev)[(*n)++];
+	e->time = time;
+	e->seq = seq;
+	e->proc = proc;
+	e->op = op;
+	e->arg = arg;
+} /* }}} */
+
+static int sim_event_cmp(const void *va, const void *vb) /* {{{ */
+{
+	const struct sim_event *a = va;
+	const struct sim_event *b = vb;
+	if(a->time != b->time) return (a->time > b->time) - (a->time < b->time);
+	if(a->proc != b->proc) return (a->proc > b->proc) - (a->proc < b->proc);
+	return (a->seq > b->seq) - (a->seq < b->seq);
+} /* }}} */
+
+static int sim_parse_gen(struct sim_gen *g, const char *spec) /* {{{ */
+{
+	/* returns 1 if =spec= names a workload, 0 if it does not, and -1 if
+	 * its parameters are invalid */
+	size_t len = strcspn(spec, ":");
+	int kind = 0;
+	while(gen_names[kind] && (strlen(gen_names[kind]) != len
+			|| strncmp(spec, gen_names[kind], len)))
+		kind++;
+	if(!gen_names[kind]) return 0;
+	g->kind = kind;
+	g->procs = kind == SIM_GEN_MIXED ? 4 : 1;
+	g->pages = 64;
+	g->n = 1000000;
+	g->write = 25;
+	g->seed = 1;
+	g->theta = 0.99;
+	g->len = 16;
+	g->reps = 8;
+	g->burst = 16;
+	const char *p = spec + len;
+	while(*p) {
+		char key[16];
+		double value;
+		int used;
+		if(sscanf(p + 1, "%15[a-z]=%lf%n", key, &value, &used) != 2)
+			return -1;
+		p += used + 1;
+		if(*p && *p != ',') return -1;
+		if(!strcmp(key, "procs")) g->procs = (int)value;
+		else if(!strcmp(key, "pages")) g->pages = (int)value;
+		else if(!strcmp(key, "n")) g->n = (long)value;
+		else if(!strcmp(key, "write")) g->write = (int)value;
+		else if(!strcmp(key, "seed")) g->seed = (uint64_t)value;
+		else if(!strcmp(key, "theta")) g->theta = value;
+		else if(!strcmp(key, "len")) g->len = (int)value;
+		else if(!strcmp(key, "reps")) g->reps = (int)value;
+		else if(!strcmp(key, "burst")) g->burst = (int)value;
+		else return -1;
+	}
+	if(g->procs < 1 || g->procs > SIM_MAX_PROCS) return -1;
+	if(g->pages < 1 || g->pages > SIM_MAX_PAGES) return -1;
+	if(g->len > g->pages) g->len = g->pages;
+	if(g->len < 1 || g->reps < 1 || g->burst < 1) return -1;
+	if(g->n < 0 || g->write < 0 || g->write > 100) return -1;
+	return 1;
+} /* }}} */
+
+static void sim_generate(struct sim_trace *t, const struct sim_gen *g) /* {{{ */
+{
+	uint64_t rng = g->seed ? g->seed : 1;
+	/* Zipf ranks are mapped to pages by a permutation per process */
+	double *cdf = malloc(g->pages * sizeof(*cdf));
+	uint16_t (*perm)[SIM_MAX_PAGES] = malloc(g->procs * sizeof(*perm));
+	long *count = calloc(g->procs, sizeof(*count));
+	if(!cdf || !perm || !count) {
+		perror("sim_generate");
+		exit(EXIT_FAILURE);
+	}
+	double sum = 0;
+	for(int i = 0; i < g->pages; ++i) {
+		sum += 1 / pow(i + 1, g->theta);
+		cdf[i] = sum;
+	}
+	for(int p = 0; p < g->procs; ++p) {
+		for(int i = 0; i < g->pages; ++i) perm[p][i] = i;
+		for(int i = g->pages - 1; i > 0; --i) {
+			int j = sim_rand(&rng) % (i + 1);
+			uint16_t tmp = perm[p][i];
+			perm[p][i] = perm[p][j];
+			perm[p][j] = tmp;
+		}
+		sim_push(t, SIM_CREATE, p, 0);
+		sim_push(t, SIM_EXTEND, p, g->pages);
+	}
+	t->nprocs = g->procs;
+
+	int p = 0;
+	for(long i = 0; i < g->n; ++i) {
+		/* processes run for =burst= accesses at a time */
+		if(i % g->burst == 0) p = sim_rand(&rng) % g->procs;
+		int kind = g->kind == SIM_GEN_MIXED ? p % SIM_GEN_MIXED : g->kind;
+		long c = count[p]++;
+		int page = 0;
+		switch(kind) {
+		case SIM_GEN_SEQ:
+			page = c % g->pages;
+			break;
+		case SIM_GEN_ZIPF: {
+			double u = (sim_rand(&rng) >> 11) * 0x1.0p-53 * sum;
+			int lo = 0;
+			int hi = g->pages - 1;
+			while(lo < hi) {
+				int mid = (lo + hi) / 2;
+				if(cdf[mid] < u) lo = mid + 1;
+				else hi = mid;
+			}
+			page = perm[p][lo];
+			break;
+		}
+		case SIM_GEN_LOOP: {
+			long window = c / ((long)g->len * g->reps);
+			page = (window * g->len + c % g->len) % g->pages;
+			break;
+		}
+		}
+		int write = (int)(sim_rand(&rng) % 100) < g->write;
+		sim_push(t, write ? SIM_WRITE : SIM_READ, p, page);
+	}
+	for(int q = 0; q < g->procs; ++q) sim_push(t, SIM_DESTROY, q, 0);
+	free(cdf);
+	free(perm);
+	free(count);
+} /* }}} */
+
+static uint64_t sim_rand(uint64_t *state) /* {{{ */
+{
+	/* xorshift64* */
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+} /* }}} */
+
+static double sim_now(void) /* {{{ */
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+} /* }}} */
+
+static intptr_t sim_page(void *vaddr) /* {{{ */
+{
+	return ((intptr_t)vaddr - UVM_BASEADDR) / SIM_PAGE_SIZE;
+} /* }}} */
+
+static void sim_run_pager(const struct sim_trace *t, struct sim_result *r) /* {{{ */
+{
+	memset(r, 0, sizeof(*r));
+	double start = sim_now();
+	for(size_t i = 0; i < t->n; ++i) {
+		const struct sim_op *o = &t->ops[i];
+		switch(o->op) {
+		case SIM_CREATE:
+			pager_create(o->pid);
+			memset(sim.prot[o->pid], PROT_NONE, sizeof(sim.prot[o->pid]));
+			memset(sim.frame[o->pid], 0xff, sizeof(sim.frame[o->pid]));
+			break;
+		case SIM_EXTEND: {
+			int count;
+			if(!pager_extend_run(o->pid, o->arg, &count)
+					|| count != o->arg) {
+				fprintf(stderr, "pager_extend: out of blocks\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		}
+		case SIM_READ:
+		case SIM_WRITE: {
+			int need = o->op == SIM_WRITE ? PROT_WRITE : PROT_READ;
+			void *vaddr = (void *)(UVM_BASEADDR + o->arg * SIM_PAGE_SIZE);
+			/* a write to an unmapped page faults twice */
+			for(int tries = 0; !(sim.prot[o->pid][o->arg] & need); ++tries) {
+				if(tries == 2 || pager_fault(o->pid, vaddr)) {
+					fprintf(stderr, "pager_fault: pid %d page %d not "
+							"mapped: %s\n", o->pid, o->arg,
+							tries == 2 ? "loop" : strerror(errno));
+					exit(EXIT_FAILURE);
+				}
+				r->faults++;
+			}
+			break;
+		}
+		case SIM_DESTROY:
+			pager_destroy(o->pid);
+			memset(sim.prot[o->pid], PROT_NONE, sizeof(sim.prot[o->pid]));
+			memset(sim.frame[o->pid], 0xff, sizeof(sim.frame[o->pid]));
+			break;
+		}
+	}
+	r->secs = sim_now() - start;
+	r->pageins = sim.zero_fills + sim.disk_reads;
+	r->writebacks = sim.disk_writes;
+} /* }}} */
+
+static void sim_run_policy(const struct sim_trace *t, int policy, /* {{{ */
+		int nframes, struct sim_result *r)
+{
+	memset(r, 0, sizeof(*r));
+	struct sim_cache *c = malloc(sizeof(*c));
+	uint64_t *next = NULL;
+	if(!c) exit(EXIT_FAILURE);
+	c->nframes = nframes;
+	c->nfree = nframes;
+	c->owner = malloc(nframes * sizeof(*c->owner));
+	c->prio = calloc(nframes, sizeof(*c->prio));
+	c->dirty = calloc(nframes, sizeof(*c->dirty));
+	if(!c->owner || !c->prio || !c->dirty) exit(EXIT_FAILURE);
+	for(int f = 0; f < nframes; ++f) c->owner[f] = -1;
+	for(int k = 0; k < SIM_NKEYS; ++k) c->where[k] = -1;
+	if(policy == SIM_POLICY_OPT) {
+		/* the time of each access's next access to the same page */
+		next = malloc(t->n * sizeof(*next));
+		uint64_t *last = malloc(SIM_NKEYS * sizeof(*last));
+		if(!next || !last) exit(EXIT_FAILURE);
+		for(int k = 0; k < SIM_NKEYS; ++k) last[k] = UINT64_MAX;
+		for(size_t i = t->n; i-- > 0;) {
+			const struct sim_op *o = &t->ops[i];
+			int32_t key = o->pid * SIM_MAX_PAGES + o->arg;
+			if(o->op != SIM_READ && o->op != SIM_WRITE) continue;
+			next[i] = last[key];
+			last[key] = i;
+		}
+		free(last);
+	}
+
+	double start = sim_now();
+	for(size_t i = 0; i < t->n; ++i) {
+		const struct sim_op *o = &t->ops[i];
+		if(o->op == SIM_DESTROY) {
+			for(int f = 0; f < nframes; ++f) {
+				if(c->owner[f] == -1 || c->owner[f] / SIM_MAX_PAGES != o->pid)
+					continue;
+				c->where[c->owner[f]] = -1;
+				c->owner[f] = -1;
+				c->nfree++;
+			}
+			continue;
+		}
+		if(o->op != SIM_READ && o->op != SIM_WRITE) continue;
+		int32_t key = o->pid * SIM_MAX_PAGES + o->arg;
+		int f = c->where[key];
+		if(f == -1) {
+			r->faults++;
+			r->pageins++;
+			f = 0;
+			if(c->nfree) {
+				while(c->owner[f] != -1) f++;
+				c->nfree--;
+			} else {
+				for(int g = 1; g < nframes; ++g)
+					if(c->prio[g] < c->prio[f]) f = g;
+				if(c->dirty[f]) r->writebacks++;
+				c->where[c->owner[f]] = -1;
+			}
+			c->owner[f] = key;
+			c->dirty[f] = 0;
+			c->where[key] = f;
+			if(policy == SIM_POLICY_FIFO) c->prio[f] = i;
+		}
+		if(o->op == SIM_WRITE) c->dirty[f] = 1;
+		if(policy == SIM_POLICY_LRU) c->prio[f] = i;
+		if(policy == SIM_POLICY_OPT) c->prio[f] = UINT64_MAX - next[i];
+	}
+	r->secs = sim_now() - start;
+	free(next);
+	free(c->owner);
+	free(c->prio);
+	free(c->dirty);
+	free(c);
+} /* }}} */
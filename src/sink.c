@@ -0,0 +1,272 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sink.h"
+#include "trace.h"
+
+/*****************************************************************************
+ * sink struct and function declarations
+ ****************************************************************************/
+#define SINK_STDOUT 1
+#define SINK_FILE 2
+#define SINK_RING 3
+
+#define SINK_IOV_MAX 16
+/* bytes of an incomplete line a stdout sink holds per thread */
+#define SINK_LINE_MAX (1 << 20)
+
+struct sink_line {
+	char *data;
+	size_t len;
+	size_t cap;
+};
+
+struct sink {
+	int type;
+	int fd;
+	/* ring sinks: =ring= holds =size= bytes, =head= is where the next byte
+	 * goes and =used= counts valid bytes */
+	char *ring;
+	size_t size;
+	size_t head;
+	size_t used;
+	/* stdout sinks: incomplete lines of each thread */
+	pthread_key_t lines;
+	pthread_mutex_t mutex;
+};
+
+static int sink_writev_all(int fd, const struct iovec *iov, int iovcnt);
+static int sink_stdout_write(struct sink *sink, const struct iovec *iov,
+		int iovcnt);
+static void sink_line_free(void *vline);
+static void sink_ring_append(struct sink *sink, const char *data, size_t len);
+
+/*****************************************************************************
+ * sink function implementations
+ ****************************************************************************/
+struct sink * sink_open(const char *spec) /* {{{ */
+{
+	struct sink *sink = malloc(sizeof(*sink));
+	if(!sink) return NULL;
+	sink->type = 0;
+	sink->fd = -1;
+	sink->ring = NULL;
+	sink->size = sink->head = sink->used = 0;
+	if(!strcmp(spec, "stdout")) {
+		sink->type = SINK_STDOUT;
+		sink->fd = STDOUT_FILENO;
+		errno = pthread_key_create(&sink->lines, sink_line_free);
+		if(errno) goto out;
+	} else if(!strncmp(spec, "file:", 5)) {
+		sink->type = SINK_FILE;
+		sink->fd = open(spec + 5, O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if(sink->fd == -1) goto out;
+	} else if(!strncmp(spec, "ring:", 5)) {
+		sink->type = SINK_RING;
+		char *end;
+		unsigned long size = strtoul(spec + 5, &end, 10);
+		if(size == 0 || *end != '\0') {
+			errno = EINVAL;
+			goto out;
+		}
+		sink->ring = malloc(size);
+		if(!sink->ring) goto out;
+		sink->size = size;
+	} else {
+		errno = EINVAL;
+		goto out;
+	}
+	if(pthread_mutex_init(&sink->mutex, NULL)) goto out;
+	return sink;
+
+	out:
+	{ int tmp = errno;
+	if(sink->type == SINK_FILE && sink->fd != -1) close(sink->fd);
+	free(sink->ring);
+	free(sink);
+	errno = tmp; }
+	return NULL;
+} /* }}} */
+
+void sink_close(struct sink *sink) /* {{{ */
+{
+	if(sink->type == SINK_RING && sink->used) {
+		/* the oldest byte sits right after the newest one */
+		size_t start = (sink->head + sink->size - sink->used) % sink->size;
+		struct iovec iov[2];
+		int iovcnt = 1;
+		iov[0].iov_base = sink->ring + start;
+		iov[0].iov_len = sink->used;
+		if(start + sink->used > sink->size) {
+			iov[0].iov_len = sink->size - start;
+			iov[1].iov_base = sink->ring;
+			iov[1].iov_len = sink->used - iov[0].iov_len;
+			iovcnt = 2;
+		}
+		fflush(stdout);
+		sink_writev_all(STDOUT_FILENO, iov, iovcnt);
+	}
+	if(sink->type == SINK_STDOUT) {
+		/* only the calling thread's line can be reached */
+		struct sink_line *line = pthread_getspecific(sink->lines);
+		if(line && line->len) {
+			struct iovec iov = {line->data, line->len};
+			if(!trace_stdout(&iov, 1)) {
+				fflush(stdout);
+				sink_writev_all(STDOUT_FILENO, &iov, 1);
+			}
+		}
+		pthread_setspecific(sink->lines, NULL);
+		sink_line_free(line);
+		pthread_key_delete(sink->lines);
+	}
+	if(sink->type == SINK_FILE) close(sink->fd);
+	pthread_mutex_destroy(&sink->mutex);
+	free(sink->ring);
+	free(sink);
+} /* }}} */
+
+int sink_write(struct sink *sink, const struct iovec *iov, int iovcnt) /* {{{ */
+{
+	int ret = 0;
+	pthread_mutex_lock(&sink->mutex);
+	switch(sink->type) {
+	case SINK_STDOUT:
+		ret = sink_stdout_write(sink, iov, iovcnt);
+		break;
+	case SINK_FILE:
+		ret = sink_writev_all(sink->fd, iov, iovcnt);
+		break;
+	case SINK_RING:
+		for(int i = 0; i < iovcnt; ++i)
+			sink_ring_append(sink, iov[i].iov_base, iov[i].iov_len);
+		break;
+	}
+	pthread_mutex_unlock(&sink->mutex);
+	return ret;
+} /* }}} */
+
+/*****************************************************************************
+ * static function implementations
+ ****************************************************************************/
+static int sink_writev_all(int fd, const struct iovec *iov, int iovcnt) /* {{{ */
+{
+	struct iovec local[SINK_IOV_MAX];
+	if(iovcnt > SINK_IOV_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(local, iov, iovcnt * sizeof(*iov));
+	struct iovec *cur = local;
+	while(iovcnt > 0) {
+		ssize_t n = writev(fd, cur, iovcnt);
+		if(n == -1) {
+			if(errno == EINTR) continue;
+			return -1;
+		}
+		/* resume after short writes */
+		while(iovcnt > 0 && (size_t)n >= cur->iov_len) {
+			n -= cur->iov_len;
+			cur++;
+			iovcnt--;
+		}
+		if(iovcnt > 0) {
+			cur->iov_base = (char *)cur->iov_base + n;
+			cur->iov_len -= n;
+		}
+	}
+	return 0;
+} /* }}} */
+
+static int sink_stdout_write(struct sink *sink, const struct iovec *iov, /* {{{ */
+		int iovcnt)
+{
+	/* Other threads print to stdout through stdio, so lines are only
+	 * written once complete; otherwise stdio output could land inside
+	 * them.  Holding stdout's lock until the newline is no option, as
+	 * writers take the pager's locks between chunks while other
+	 * threads print holding them.  Lines longer than SINK_LINE_MAX are
+	 * written as they come once that much is held. */
+	int i = iovcnt - 1;
+	while(i >= 0 && iov[i].iov_len == 0) i--;
+	if(i < 0) return 0;
+	const char *last = iov[i].iov_base;
+	int eol = last[iov[i].iov_len - 1] == '\n';
+	struct sink_line *line = pthread_getspecific(sink->lines);
+	if(eol && (!line || line->len == 0)) {
+		if(trace_stdout(iov, iovcnt)) return 0;
+		fflush(stdout);
+		return sink_writev_all(sink->fd, iov, iovcnt);
+	}
+	if(!line) {
+		line = calloc(1, sizeof(*line));
+		if(!line) return -1;
+		pthread_setspecific(sink->lines, line);
+	}
+	size_t total = line->len;
+	for(i = 0; i < iovcnt; ++i) total += iov[i].iov_len;
+	if(total > SINK_LINE_MAX) {
+		if(iovcnt + 1 > SINK_IOV_MAX) {
+			errno = EINVAL;
+			return -1;
+		}
+		struct iovec all[SINK_IOV_MAX];
+		all[0].iov_base = line->data;
+		all[0].iov_len = line->len;
+		memcpy(all + 1, iov, iovcnt * sizeof(*iov));
+		line->len = 0;
+		if(trace_stdout(all, iovcnt + 1)) return 0;
+		fflush(stdout);
+		return sink_writev_all(sink->fd, all, iovcnt + 1);
+	}
+	for(i = 0; i < iovcnt; ++i) {
+		if(line->len + iov[i].iov_len > line->cap) {
+			size_t cap = line->cap ? line->cap : 4096;
+			while(cap < line->len + iov[i].iov_len) cap *= 2;
+			if(cap > SINK_LINE_MAX) cap = SINK_LINE_MAX;
+			char *data = realloc(line->data, cap);
+			if(!data) return -1;
+			line->data = data;
+			line->cap = cap;
+		}
+		memcpy(line->data + line->len, iov[i].iov_base, iov[i].iov_len);
+		line->len += iov[i].iov_len;
+	}
+	if(!eol) return 0;
+	struct iovec whole = {line->data, line->len};
+	line->len = 0;
+	if(trace_stdout(&whole, 1)) return 0;
+	fflush(stdout);
+	return sink_writev_all(sink->fd, &whole, 1);
+} /* }}} */
+
+static void sink_line_free(void *vline) /* {{{ */
+{
+	struct sink_line *line = vline;
+	if(!line) return;
+	free(line->data);
+	free(line);
+} /* }}} */
+
+static void sink_ring_append(struct sink *sink, const char *data, size_t len) /* {{{ */
+{
+	if(len >= sink->size) {
+		/* only the tail of the data survives */
+		memcpy(sink->ring, data + len - sink->size, sink->size);
+		sink->head = 0;
+		sink->used = sink->size;
+		return;
+	}
+	size_t first = sink->size - sink->head;
+	if(first > len) first = len;
+	memcpy(sink->ring + sink->head, data, first);
+	memcpy(sink->ring, data + first, len - first);
+	sink->head = (sink->head + len) % sink->size;
+	sink->used += len;
+	if(sink->used > sink->size) sink->used = sink->size;
+} /* }}} */
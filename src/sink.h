@@ -0,0 +1,34 @@
+/* This module implements output sinks for streamed records.  Sinks are created
+ * from a specification string:
+ *
+ *   "stdout"       writes complete lines to the standard output, after
+ *                  flushing stdio so they stay ordered with printf calls
+ *                  (incomplete lines are held in memory until their
+ *                  newline is written, up to 1 MiB per thread; longer
+ *                  lines are written in pieces, and other output may land
+ *                  between them); when the MMU trace is binary, lines are
+ *                  recorded in the trace instead;
+ *   "file:PATH"    appends to the file at PATH;
+ *   "ring:BYTES"   keeps the last BYTES bytes written in memory, and writes
+ *                  them to the standard output when the sink is closed.
+ *
+ * Sinks are thread-safe, and the data passed to each =sink_write= call is
+ * written contiguously. */
+
+#ifndef __SINK_HEADER__
+#define __SINK_HEADER__
+
+#include <sys/uio.h>
+
+/* This function creates a sink following =spec=.  Returns NULL and sets
+ * =errno= if =spec= is invalid or the sink cannot be opened. */
+struct sink * sink_open(const char *spec);
+
+/* This function flushes and closes the sink, freeing used memory. */
+void sink_close(struct sink *sink);
+
+/* This function writes the =iovcnt= buffers in =iov= to the sink.  Returns 0
+ * on success and -1 on failure. */
+int sink_write(struct sink *sink, const struct iovec *iov, int iovcnt);
+
+#endif
@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "slab.h"
+
+/*****************************************************************************
+ * slab struct declarations
+ ****************************************************************************/
+#define SLAB_ALIGN (sizeof(long double))
+
+struct slab_chunk {
+	struct slab_chunk *next;
+	unsigned used;
+	/* objects follow the header, aligned to SLAB_ALIGN */
+};
+
+struct slab_cache {
+	size_t objsize;
+	size_t hdrsize;
+	unsigned chunkobjs;
+	struct slab_chunk *chunks;
+	pthread_mutex_t mutex;
+};
+
+static struct slab_chunk * slab_chunk_get(struct slab_cache *cache);
+
+/*****************************************************************************
+ * slab function implementations
+ ****************************************************************************/
+struct slab_cache * slab_cache_create(size_t objsize, unsigned chunkobjs) /* {{{ */
+{
+	if(objsize == 0 || chunkobjs == 0) return NULL;
+	struct slab_cache *cache = malloc(sizeof(*cache));
+	if(!cache) return NULL;
+	/* freed objects store the freelist link in their first bytes */
+	if(objsize < sizeof(void *)) objsize = sizeof(void *);
+	cache->objsize = (objsize + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+	cache->hdrsize = (sizeof(struct slab_chunk) + SLAB_ALIGN - 1)
+			& ~(SLAB_ALIGN - 1);
+	cache->chunkobjs = chunkobjs;
+	cache->chunks = NULL;
+	if(pthread_mutex_init(&cache->mutex, NULL)) {
+		free(cache);
+		return NULL;
+	}
+	return cache;
+} /* }}} */
+
+void slab_cache_destroy(struct slab_cache *cache) /* {{{ */
+{
+	struct slab_chunk *chunk = cache->chunks;
+	while(chunk) {
+		struct slab_chunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	pthread_mutex_destroy(&cache->mutex);
+	free(cache);
+} /* }}} */
+
+void slab_arena_init(struct slab_arena *arena, struct slab_cache *cache) /* {{{ */
+{
+	arena->cache = cache;
+	arena->head = NULL;
+	arena->tail = NULL;
+	arena->freelist = NULL;
+} /* }}} */
+
+void slab_arena_release(struct slab_arena *arena) /* {{{ */
+{
+	struct slab_cache *cache = arena->cache;
+	if(arena->head) {
+		pthread_mutex_lock(&cache->mutex);
+		arena->tail->next = cache->chunks;
+		cache->chunks = arena->head;
+		pthread_mutex_unlock(&cache->mutex);
+	}
+	arena->head = NULL;
+	arena->tail = NULL;
+	arena->freelist = NULL;
+} /* }}} */
+
+void * slab_alloc(struct slab_arena *arena) /* {{{ */
+{
+	struct slab_cache *cache = arena->cache;
+	if(arena->freelist) {
+		void *obj = arena->freelist;
+		arena->freelist = *(void **)obj;
+		return obj;
+	}
+	struct slab_chunk *chunk = arena->head;
+	if(!chunk || chunk->used == cache->chunkobjs) {
+		chunk = slab_chunk_get(cache);
+		if(!chunk) return NULL;
+		chunk->next = arena->head;
+		arena->head = chunk;
+		if(!arena->tail) arena->tail = chunk;
+	}
+	char *base = (char *)chunk + cache->hdrsize;
+	return base + cache->objsize * chunk->used++;
+} /* }}} */
+
+void slab_free(struct slab_arena *arena, void *obj) /* {{{ */
+{
+	*(void **)obj = arena->freelist;
+	arena->freelist = obj;
+} /* }}} */
+
+/*****************************************************************************
+ * static function implementations
+ ****************************************************************************/
+static struct slab_chunk * slab_chunk_get(struct slab_cache *cache) /* {{{ */
+{
+	pthread_mutex_lock(&cache->mutex);
+	struct slab_chunk *chunk = cache->chunks;
+	if(chunk) cache->chunks = chunk->next;
+	pthread_mutex_unlock(&cache->mutex);
+	if(!chunk) {
+		chunk = malloc(cache->hdrsize + cache->objsize * cache->chunkobjs);
+		if(!chunk) return NULL;
+	}
+	chunk->next = NULL;
+	chunk->used = 0;
+	return chunk;
+} /* }}} */
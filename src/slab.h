@@ -0,0 +1,60 @@
+/* This module implements a fixed-size object allocator for small, frequently
+ * allocated structures.  The interface is as follows:
+ *
+ * (1) create a =slab_cache= for each object size using =slab_cache_create=
+ * (2) initialize one or more arenas over the cache with =slab_arena_init=
+ * (3) allocate and free objects with =slab_alloc= and =slab_free=
+ * (4) release all objects in an arena at once with =slab_arena_release=.
+ *
+ * Objects are carved out of chunks holding a fixed number of objects.  Each
+ * arena owns the chunks it carved objects from, and releasing an arena
+ * splices its chunk list back into the cache in constant time, regardless of
+ * how many objects were allocated.  Chunks are recycled by the cache and only
+ * returned to the system by =slab_cache_destroy=, which keeps fragmentation
+ * low in long-running programs.
+ *
+ * Caches are thread-safe.  Arenas are not: callers must serialize calls that
+ * operate on the same arena. */
+
+#ifndef __SLAB_HEADER__
+#define __SLAB_HEADER__
+
+#include <stddef.h>
+
+struct slab_chunk;
+
+struct slab_cache;
+
+struct slab_arena {
+	struct slab_cache *cache;
+	struct slab_chunk *head;
+	struct slab_chunk *tail;
+	void *freelist;
+};
+
+/* This function creates a cache of objects with =objsize= bytes, allocated
+ * from the system in chunks of =chunkobjs= objects.  Returns NULL on
+ * failure. */
+struct slab_cache * slab_cache_create(size_t objsize, unsigned chunkobjs);
+
+/* This function frees all chunks owned by the cache.  All arenas using the
+ * cache must have been released. */
+void slab_cache_destroy(struct slab_cache *cache);
+
+/* This function initializes an empty arena that gets chunks from =cache=. */
+void slab_arena_init(struct slab_arena *arena, struct slab_cache *cache);
+
+/* This function returns all chunks in =arena= to its cache, invalidating
+ * every object allocated from the arena.  The arena is left empty and can be
+ * reused. */
+void slab_arena_release(struct slab_arena *arena);
+
+/* This function returns an uninitialized object from =arena=, or NULL if
+ * memory is exhausted. */
+void * slab_alloc(struct slab_arena *arena);
+
+/* This function returns =obj= to =arena= so it can be handed out again by
+ * =slab_alloc=.  Objects need not be freed before =slab_arena_release=. */
+void slab_free(struct slab_arena *arena, void *obj);
+
+#endif
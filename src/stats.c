@@ -0,0 +1,197 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+/*****************************************************************************
+ * static variables and function declarations
+ ****************************************************************************/
+struct stats_thread {
+	struct stats stats;
+	struct stats_thread *prev;
+	struct stats_thread *next;
+};
+
+static const char *counter_names[STATS_NCOUNTERS] = {
+	"fault_zero", "fault_prot", "fault_swapin", "evict", "writeback",
+	"disk_read", "sweep", "lock_wait_ns"
+};
+static const char *hist_names[STATS_NHISTS] = {
+	"create", "extend", "syslog", "segv", "exit"
+};
+
+/* =stats_mutex= protects the list of live threads and =stats_retired=, which
+ * accumulates the statistics of threads that exited */
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct stats_thread *stats_threads = NULL;
+static struct stats stats_retired;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;
+static __thread struct stats_thread *stats_self = NULL;
+
+static struct stats * stats_local(void);
+static void stats_key_create(void);
+static void stats_thread_exit(void *vthread);
+static void stats_merge(struct stats *dst, const struct stats *src);
+static int stats_bucket(uint64_t value);
+static uint64_t stats_bucket_value(int bucket);
+
+/*****************************************************************************
+ * public function implementations
+ ****************************************************************************/
+uint64_t stats_now(void) /* {{{ */
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+} /* }}} */
+
+void stats_add(int counter, uint64_t n) /* {{{ */
+{
+	struct stats *s = stats_local();
+	if(!s) return;
+	/* only this thread writes; relaxed atomics keep readers tear-free */
+	__atomic_fetch_add(&s->counters[counter], n, __ATOMIC_RELAXED);
+} /* }}} */
+
+void stats_record(int hist, uint64_t value) /* {{{ */
+{
+	struct stats *s = stats_local();
+	if(!s) return;
+	struct stats_hist *h = &s->hists[hist];
+	__atomic_fetch_add(&h->buckets[stats_bucket(value)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, value, __ATOMIC_RELAXED);
+	if(value > h->max) __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+} /* }}} */
+
+void stats_read(struct stats *out) /* {{{ */
+{
+	pthread_mutex_lock(&stats_mutex);
+	memcpy(out, &stats_retired, sizeof(*out));
+	for(struct stats_thread *t = stats_threads; t; t = t->next)
+		stats_merge(out, &t->stats);
+	pthread_mutex_unlock(&stats_mutex);
+} /* }}} */
+
+uint64_t stats_percentile(const struct stats_hist *hist, double pct) /* {{{ */
+{
+	if(!hist->count) return 0;
+	uint64_t rank = (uint64_t)(hist->count * pct / 100);
+	if(rank >= hist->count) rank = hist->count - 1;
+	uint64_t seen = 0;
+	for(int i = 0; i < STATS_BUCKETS; ++i) {
+		seen += hist->buckets[i];
+		if(seen > rank) return stats_bucket_value(i);
+	}
+	return hist->max;
+} /* }}} */
+
+const char * stats_counter_name(int counter) /* {{{ */
+{
+	return counter_names[counter];
+} /* }}} */
+
+const char * stats_hist_name(int hist) /* {{{ */
+{
+	return hist_names[hist];
+} /* }}} */
+
+void stats_print(FILE *file) /* {{{ */
+{
+	struct stats *s = malloc(sizeof(*s));
+	if(!s) return;
+	stats_read(s);
+	for(int i = 0; i < STATS_NCOUNTERS; ++i) {
+		fprintf(file, "stats %s %llu\n", counter_names[i],
+				(unsigned long long)s->counters[i]);
+	}
+	for(int i = 0; i < STATS_NHISTS; ++i) {
+		const struct stats_hist *h = &s->hists[i];
+		fprintf(file, "stats %s_ns count %llu mean %llu p50 %llu p99 %llu "
+				"max %llu\n", hist_names[i],
+				(unsigned long long)h->count,
+				(unsigned long long)(h->count ? h->sum / h->count : 0),
+				(unsigned long long)stats_percentile(h, 50),
+				(unsigned long long)stats_percentile(h, 99),
+				(unsigned long long)h->max);
+	}
+	fflush(file);
+	free(s);
+} /* }}} */
+
+/*****************************************************************************
+ * static function implementations
+ ****************************************************************************/
+static struct stats * stats_local(void) /* {{{ */
+{
+	if(stats_self) return &stats_self->stats;
+	pthread_once(&stats_once, stats_key_create);
+	struct stats_thread *t = calloc(1, sizeof(*t));
+	if(!t) return NULL;
+	pthread_mutex_lock(&stats_mutex);
+	t->next = stats_threads;
+	if(stats_threads) stats_threads->prev = t;
+	stats_threads = t;
+	pthread_mutex_unlock(&stats_mutex);
+	pthread_setspecific(stats_key, t);
+	stats_self = t;
+	return &t->stats;
+} /* }}} */
+
+static void stats_key_create(void) /* {{{ */
+{
+	pthread_key_create(&stats_key, stats_thread_exit);
+} /* }}} */
+
+static void stats_thread_exit(void *vthread) /* {{{ */
+{
+	/* keep the counts of threads that exit, as clients come and go */
+	struct stats_thread *t = vthread;
+	pthread_mutex_lock(&stats_mutex);
+	stats_merge(&stats_retired, &t->stats);
+	if(t->prev) t->prev->next = t->next;
+	else stats_threads = t->next;
+	if(t->next) t->next->prev = t->prev;
+	pthread_mutex_unlock(&stats_mutex);
+	stats_self = NULL;
+	free(t);
+} /* }}} */
+
+static void stats_merge(struct stats *dst, const struct stats *src) /* {{{ */
+{
+	for(int i = 0; i < STATS_NCOUNTERS; ++i)
+		dst->counters[i] += __atomic_load_n(&src->counters[i], __ATOMIC_RELAXED);
+	for(int i = 0; i < STATS_NHISTS; ++i) {
+		struct stats_hist *d = &dst->hists[i];
+		const struct stats_hist *s = &src->hists[i];
+		d->count += __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+		d->sum += __atomic_load_n(&s->sum, __ATOMIC_RELAXED);
+		uint64_t max = __atomic_load_n(&s->max, __ATOMIC_RELAXED);
+		if(max > d->max) d->max = max;
+		for(int j = 0; j < STATS_BUCKETS; ++j)
+			d->buckets[j] += __atomic_load_n(&s->buckets[j],
+					__ATOMIC_RELAXED);
+	}
+} /* }}} */
+
+static int stats_bucket(uint64_t value) /* {{{ */
+{
+	/* values below 2*STATS_SUBBUCKETS get a bucket each; above that,
+	 * the most significant bit picks the power of two and the next
+	 * three bits the bucket within it */
+	if(value < 2 * STATS_SUBBUCKETS) return (int)value;
+	int msb = 63 - __builtin_clzll(value);
+	int sub = (int)(value >> (msb - 3)) & (STATS_SUBBUCKETS - 1);
+	return (msb - 2) * STATS_SUBBUCKETS + sub;
+} /* }}} */
+
+static uint64_t stats_bucket_value(int bucket) /* {{{ */
+{
+	if(bucket < 2 * STATS_SUBBUCKETS) return (uint64_t)bucket;
+	int msb = bucket / STATS_SUBBUCKETS + 2;
+	int sub = bucket % STATS_SUBBUCKETS;
+	return (uint64_t)(STATS_SUBBUCKETS + sub) << (msb - 3);
+} /* }}} */
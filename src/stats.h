@@ -0,0 +1,77 @@
+/* This module keeps event counters and latency histograms for the MMU.  Each
+ * thread updates its own copy of the statistics without locking; readers
+ * merge the copies of all threads, including those of threads that already
+ * exited.  Counts may lag behind by the updates in progress while they are
+ * read.
+ *
+ * Histograms are log-linear: each power of two is split into
+ * =STATS_SUBBUCKETS= buckets, so recorded values keep three significant bits
+ * over the whole 64-bit range. */
+
+#ifndef __STATS_HEADER__
+#define __STATS_HEADER__
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* counters, see =stats_counter_name= */
+#define STATS_FAULT_ZERO 0   /* first touches, served with a zero-filled frame */
+#define STATS_FAULT_PROT 1   /* faults on resident pages (protection upgrades) */
+#define STATS_FAULT_SWAPIN 2 /* faults served by reading the page from disk */
+#define STATS_EVICT 3        /* pages evicted from memory */
+#define STATS_WRITEBACK 4    /* pages written to disk */
+#define STATS_DISK_READ 5    /* pages read from disk */
+#define STATS_SWEEP 6        /* frames visited by the clock algorithm */
+#define STATS_LOCK_WAIT 7    /* nanoseconds spent waiting for pager locks */
+#define STATS_NCOUNTERS 8
+
+/* histograms of the time spent handling each request type, in nanoseconds */
+#define STATS_CREATE 0
+#define STATS_EXTEND 1
+#define STATS_SYSLOG 2
+#define STATS_SEGV 3
+#define STATS_EXIT 4
+#define STATS_NHISTS 5
+
+#define STATS_SUBBUCKETS 8
+#define STATS_BUCKETS (62 * STATS_SUBBUCKETS)
+
+struct stats_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[STATS_BUCKETS];
+};
+
+struct stats {
+	uint64_t counters[STATS_NCOUNTERS];
+	struct stats_hist hists[STATS_NHISTS];
+};
+
+/* This function returns a monotonic timestamp in nanoseconds. */
+uint64_t stats_now(void);
+
+/* This function adds =n= to =counter= in the calling thread's statistics. */
+void stats_add(int counter, uint64_t n);
+
+/* This function records =value= in histogram =hist= of the calling thread's
+ * statistics. */
+void stats_record(int hist, uint64_t value);
+
+/* This function stores the statistics of all threads, merged, in =out=. */
+void stats_read(struct stats *out);
+
+/* This function returns the value below which =pct= percent of the values
+ * recorded in =hist= lie, rounded down to its bucket's lower bound.  Returns
+ * 0 if the histogram is empty. */
+uint64_t stats_percentile(const struct stats_hist *hist, double pct);
+
+/* These functions return the names of counters and histograms. */
+const char * stats_counter_name(int counter);
+const char * stats_hist_name(int hist);
+
+/* This function prints the merged statistics to =file=, one counter or
+ * histogram per line. */
+void stats_print(FILE *file);
+
+#endif
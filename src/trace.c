@@ -0,0 +1,288 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+/*****************************************************************************
+ * static variables and function declarations
+ ****************************************************************************/
+#define TRACE_RING_SIZE (1 << 16)
+#define TRACE_LIST_MAX 1024
+
+/* Each ring has a single producer, its thread, and a single consumer, the
+ * writer.  =head= and =tail= count the bytes ever produced and consumed. */
+struct trace_ring {
+	char buf[TRACE_RING_SIZE];
+	uint64_t head;
+	uint64_t tail;
+	/* the owning thread exited; the writer frees the ring once drained */
+	int dead;
+	struct trace_ring *next;
+};
+
+static int trace_binary = 0;
+static FILE *trace_file = NULL;
+static pthread_t trace_writer;
+static int trace_running = 0;
+static uint64_t trace_seq = 0;
+/* =trace_mutex= protects the list of rings */
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_ring *trace_rings = NULL;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+static __thread struct trace_ring *trace_self = NULL;
+
+static struct trace_ring * trace_local(void);
+static void trace_key_create(void);
+static void trace_thread_exit(void *vring);
+static void trace_put(struct trace_ring *r, uint64_t pos, const void *data,
+		size_t len);
+static int trace_drain(void);
+static void * trace_writer_thread(void *data);
+
+/*****************************************************************************
+ * public function implementations
+ ****************************************************************************/
+int trace_init(const char *spec) /* {{{ */
+{
+	if(!strcmp(spec, "text")) return 0;
+	if(strncmp(spec, "binary:", 7)) {
+		errno = EINVAL;
+		return -1;
+	}
+	trace_file = fopen(spec + 7, "wb");
+	if(!trace_file) return -1;
+	uint32_t size = sizeof(struct trace_event);
+	if(fwrite(TRACE_MAGIC, 8, 1, trace_file) != 1
+			|| fwrite(&size, sizeof(size), 1, trace_file) != 1) {
+		int tmp = errno;
+		fclose(trace_file);
+		errno = tmp;
+		return -1;
+	}
+	trace_running = 1;
+	errno = pthread_create(&trace_writer, NULL, trace_writer_thread, NULL);
+	if(errno) {
+		fclose(trace_file);
+		return -1;
+	}
+	trace_binary = 1;
+	return 0;
+} /* }}} */
+
+void trace_destroy(void) /* {{{ */
+{
+	if(!trace_binary) return;
+	__atomic_store_n(&trace_running, 0, __ATOMIC_RELEASE);
+	pthread_join(trace_writer, NULL);
+	trace_binary = 0;
+	fclose(trace_file);
+	trace_file = NULL;
+} /* }}} */
+
+void trace_emit(struct trace_event *ev, const void *data, size_t len) /* {{{ */
+{
+	ev->seq = __atomic_fetch_add(&trace_seq, 1, __ATOMIC_RELAXED);
+	ev->len = (uint32_t)len;
+	ev->pad = 0;
+	if(!trace_binary) {
+		ev->time = 0;
+		trace_format(stdout, ev, data);
+		return;
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ev->time = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	struct trace_ring *r = trace_local();
+	if(!r) return;
+	/* records stay 8-byte aligned in the file */
+	size_t need = sizeof(*ev) + ((len + 7) & ~(size_t)7);
+	while(TRACE_RING_SIZE - (r->head - __atomic_load_n(&r->tail,
+			__ATOMIC_ACQUIRE)) < need)
+		sched_yield();
+	static const char zeros[8];
+	/* publish the whole record at once, the writer never sees part
+	 * of it */
+	trace_put(r, r->head, ev, sizeof(*ev));
+	trace_put(r, r->head + sizeof(*ev), data, len);
+	trace_put(r, r->head + sizeof(*ev) + len, zeros,
+			need - sizeof(*ev) - len);
+	__atomic_store_n(&r->head, r->head + need, __ATOMIC_RELEASE);
+} /* }}} */
+
+int trace_stdout(const struct iovec *iov, int iovcnt) /* {{{ */
+{
+	if(!trace_binary) return 0;
+	/* keep each record well below the ring's size */
+	const size_t chunk = TRACE_RING_SIZE / 4;
+	for(int i = 0; i < iovcnt; ++i) {
+		const char *data = iov[i].iov_base;
+		for(size_t off = 0; off < iov[i].iov_len; off += chunk) {
+			size_t len = iov[i].iov_len - off;
+			if(len > chunk) len = chunk;
+			struct trace_event ev = {.op = TRACE_TEXT};
+			trace_emit(&ev, data + off, len);
+		}
+	}
+	return 1;
+} /* }}} */
+
+void trace_format(FILE *file, const struct trace_event *ev, const void *data) /* {{{ */
+{
+	void *vaddr = (void *)(uintptr_t)ev->vaddr;
+	switch(ev->op) {
+	case TRACE_CREATE:
+		fprintf(file, "pager_create pid %u\n", ev->id);
+		break;
+	case TRACE_ATTACH:
+		fprintf(file, "pager_attach pid %u npages %u\n", ev->id,
+				(unsigned)ev->npages);
+		break;
+	case TRACE_EXTEND:
+		fprintf(file, "pager_extend pid %u vaddr %p\n", ev->id, vaddr);
+		break;
+	case TRACE_SYSLOG:
+		fprintf(file, "pager_syslog pid %u %p\n", ev->id, vaddr);
+		break;
+	case TRACE_FAULT:
+		fprintf(file, "pager_fault pid %u vaddr %p\n", ev->id, vaddr);
+		break;
+	case TRACE_DESTROY:
+		fprintf(file, "pager_destroy pid %u\n", ev->id);
+		break;
+	case TRACE_ZERO_FILL:
+		fprintf(file, "mmu_zero_fill frame %u\n", ev->frame);
+		break;
+	case TRACE_RESIDENT:
+		fprintf(file, "mmu_resident pid %u vaddr %p prot %d frame %u\n",
+				ev->id, vaddr, ev->prot, ev->frame);
+		break;
+	case TRACE_RESIDENT_RUN:
+		fprintf(file, "mmu_resident_run pid %u vaddr %p npages %d prot %d "
+				"frame %u\n", ev->id, vaddr, ev->npages, ev->prot,
+				ev->frame);
+		break;
+	case TRACE_NONRESIDENT:
+		fprintf(file, "mmu_nonresident pid %u vaddr %p\n", ev->id, vaddr);
+		break;
+	case TRACE_CHPROT:
+		fprintf(file, "mmu_chprot pid %u vaddr %p prot %d\n", ev->id,
+				vaddr, ev->prot);
+		break;
+	case TRACE_DISK_READ:
+		fprintf(file, "mmu_disk_read from block %d to frame %d\n",
+				ev->block, ev->frame);
+		break;
+	case TRACE_DISK_WRITE:
+		fprintf(file, "mmu_disk_write from frame %d to block %d\n",
+				ev->frame, ev->block);
+		break;
+	case TRACE_DISK_WRITEV: {
+		const int32_t *frames = data;
+		char list[TRACE_LIST_MAX];
+		size_t len = 0;
+		list[0] = '\0';
+		for(int i = 0; i < ev->npages && len < sizeof(list); ++i) {
+			len += snprintf(list + len, sizeof(list) - len, "%s%d",
+					i ? "," : "", frames[i]);
+		}
+		fprintf(file, "mmu_disk_writev from frames %s to block %d\n",
+				list, ev->block);
+		break;
+	}
+	case TRACE_DISK_MOVE:
+		fprintf(file, "mmu_disk_move from block %d to block %d\n",
+				ev->block, ev->frame);
+		break;
+	case TRACE_TEXT:
+		fwrite(data, 1, ev->len, file);
+		break;
+	}
+} /* }}} */
+
+/*****************************************************************************
+ * static function implementations
+ ****************************************************************************/
+static struct trace_ring * trace_local(void) /* {{{ */
+{
+	if(trace_self) return trace_self;
+	pthread_once(&trace_once, trace_key_create);
+	struct trace_ring *r = calloc(1, sizeof(*r));
+	if(!r) return NULL;
+	pthread_mutex_lock(&trace_mutex);
+	r->next = trace_rings;
+	trace_rings = r;
+	pthread_mutex_unlock(&trace_mutex);
+	pthread_setspecific(trace_key, r);
+	trace_self = r;
+	return r;
+} /* }}} */
+
+static void trace_key_create(void) /* {{{ */
+{
+	pthread_key_create(&trace_key, trace_thread_exit);
+} /* }}} */
+
+static void trace_thread_exit(void *vring) /* {{{ */
+{
+	struct trace_ring *r = vring;
+	trace_self = NULL;
+	__atomic_store_n(&r->dead, 1, __ATOMIC_RELEASE);
+} /* }}} */
+
+static void trace_put(struct trace_ring *r, uint64_t pos, /* {{{ */
+		const void *data, size_t len)
+{
+	if(!len) return;
+	size_t off = pos % TRACE_RING_SIZE;
+	size_t first = TRACE_RING_SIZE - off;
+	if(first > len) first = len;
+	memcpy(r->buf + off, data, first);
+	memcpy(r->buf, (const char *)data + first, len - first);
+} /* }}} */
+
+static int trace_drain(void) /* {{{ */
+{
+	/* returns the number of bytes written */
+	int written = 0;
+	pthread_mutex_lock(&trace_mutex);
+	struct trace_ring **link = &trace_rings;
+	while(*link) {
+		struct trace_ring *r = *link;
+		int dead = __atomic_load_n(&r->dead, __ATOMIC_ACQUIRE);
+		uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		uint64_t tail = r->tail;
+		if(head == tail && dead) {
+			*link = r->next;
+			free(r);
+			continue;
+		}
+		size_t off = tail % TRACE_RING_SIZE;
+		size_t len = head - tail;
+		size_t first = TRACE_RING_SIZE - off;
+		if(first > len) first = len;
+		fwrite(r->buf + off, 1, first, trace_file);
+		fwrite(r->buf, 1, len - first, trace_file);
+		__atomic_store_n(&r->tail, head, __ATOMIC_RELEASE);
+		written += len;
+		link = &r->next;
+	}
+	pthread_mutex_unlock(&trace_mutex);
+	return written;
+} /* }}} */
+
+static void * trace_writer_thread(void *data) /* {{{ */
+{
+	const struct timespec nap = {0, 1000000};
+	while(__atomic_load_n(&trace_running, __ATOMIC_ACQUIRE)) {
+		if(!trace_drain()) nanosleep(&nap, NULL);
+	}
+	/* events emitted before trace_destroy was called */
+	while(trace_drain());
+	fflush(trace_file);
+	return NULL;
+} /* }}} */
@@ -0,0 +1,78 @@
+/* This module records the MMU's event trace.  Each event is created with
+ * =trace_emit= and rendered as one line of text by =trace_format=.  The trace
+ * is set up by =trace_init= following a specification string:
+ *
+ *   "text"         prints each event to the standard output as it happens;
+ *   "binary:PATH"  appends each event as a binary record to a lock-free ring
+ *                  owned by the calling thread; a background thread drains
+ *                  the rings to the file at PATH.
+ *
+ * Events carry a global sequence number, so =mmutrace= can put the records of
+ * a binary trace back in order and print exactly the text trace. */
+
+#ifndef __TRACE_HEADER__
+#define __TRACE_HEADER__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/uio.h>
+
+#define TRACE_MAGIC "MMUTRACE"
+
+/* event types, named after the functions that print them */
+#define TRACE_CREATE 1       /* id */
+#define TRACE_ATTACH 2       /* id, npages */
+#define TRACE_EXTEND 3       /* id, vaddr */
+#define TRACE_SYSLOG 4       /* id, vaddr */
+#define TRACE_FAULT 5        /* id, vaddr */
+#define TRACE_DESTROY 6      /* id */
+#define TRACE_ZERO_FILL 7    /* frame */
+#define TRACE_RESIDENT 8     /* id, vaddr, prot, frame */
+#define TRACE_RESIDENT_RUN 9 /* id, vaddr, npages, prot, frame */
+#define TRACE_NONRESIDENT 10 /* id, vaddr */
+#define TRACE_CHPROT 11      /* id, vaddr, prot */
+#define TRACE_DISK_READ 12   /* block, frame */
+#define TRACE_DISK_WRITE 13  /* frame, block */
+#define TRACE_DISK_WRITEV 14 /* npages frames as int32_t data, block */
+#define TRACE_DISK_MOVE 15   /* block, frame holds the target block */
+#define TRACE_TEXT 16        /* bytes written to the standard output */
+
+struct trace_event {
+	uint64_t seq;
+	uint64_t time;
+	uint32_t op;
+	/* bytes of data following the record */
+	uint32_t len;
+	uint32_t id;
+	int32_t frame;
+	int32_t block;
+	int32_t prot;
+	int32_t npages;
+	int32_t pad;
+	uint64_t vaddr;
+};
+
+/* This function sets up the trace following =spec=.  Returns 0 on success;
+ * returns -1 and sets =errno= if =spec= is invalid or the file cannot be
+ * opened. */
+int trace_init(const char *spec);
+
+/* This function drains pending events and closes the trace file.  Events
+ * emitted afterwards are printed as text. */
+void trace_destroy(void);
+
+/* This function records event =ev= followed by the =len= bytes at =data=.
+ * The sequence number and timestamp of =ev= are filled in. */
+void trace_emit(struct trace_event *ev, const void *data, size_t len);
+
+/* This function records the =iovcnt= buffers in =iov= as output to the
+ * standard output if the trace is binary, so it keeps its place among
+ * events.  Returns 1 if the buffers were recorded, and 0 if the caller
+ * should write them itself. */
+int trace_stdout(const struct iovec *iov, int iovcnt);
+
+/* This function prints event =ev= and its =data= to =file= as text. */
+void trace_format(FILE *file, const struct trace_event *ev, const void *data);
+
+#endif
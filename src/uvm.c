@@ -2,6 +2,9 @@
  * DEPARTAMENTO DE CIENCIA DA COMPUTACAO    *
  * Copyright (c) Italo Fernando Scota Cunha */
 
+/* for REG_ERR, which tells reads from writes in the SEGV handler */
+#define _GNU_SOURCE
+
 #include "uvm.h"
 
 #include <sys/mman.h>
@@ -13,32 +16,118 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <time.h>
+#include <ucontext.h>
 #include <unistd.h>
 
+#ifndef UVMLOG
+/* the log is never opened; compile logging out */
+#define LOG_MAX_VERBOSITY 0
+#endif
 #include "log.h"
 
+#include "capture.h"
+#include "frame.h"
 #include "mmu.h"
 #include "mmuproto.h"
+#include "stats.h"
+
+#define UVM_MAX_REQUESTS 64
+#define UVM_CAPTURE_BUF (1<<16)
+/* default sampling period of captures, in milliseconds */
+#define UVM_CAPTURE_PERIOD 10
+
+#if UVM_EXTENDV_MAX != MMU_PROTO_EXTENDV_MAX
+#error "UVM_EXTENDV_MAX must match MMU_PROTO_EXTENDV_MAX"
+#endif
+#if UVM_STATS_COUNTERS != MMU_PROTO_STATS_COUNTERS \
+		|| UVM_STATS_HISTS != MMU_PROTO_STATS_HISTS
+#error "UVM_STATS_* must match MMU_PROTO_STATS_*"
+#endif
+/* the MMU sends its statistics in the order of their STATS_ indices */
+#if UVM_STATS_FAULT_ZERO != STATS_FAULT_ZERO \
+		|| UVM_STATS_FAULT_PROT != STATS_FAULT_PROT \
+		|| UVM_STATS_FAULT_SWAPIN != STATS_FAULT_SWAPIN \
+		|| UVM_STATS_EVICT != STATS_EVICT \
+		|| UVM_STATS_WRITEBACK != STATS_WRITEBACK \
+		|| UVM_STATS_DISK_READ != STATS_DISK_READ \
+		|| UVM_STATS_SWEEP != STATS_SWEEP \
+		|| UVM_STATS_LOCK_WAIT != STATS_LOCK_WAIT \
+		|| UVM_STATS_CREATE != STATS_CREATE \
+		|| UVM_STATS_EXTEND != STATS_EXTEND \
+		|| UVM_STATS_SYSLOG != STATS_SYSLOG \
+		|| UVM_STATS_SEGV != STATS_SEGV \
+		|| UVM_STATS_EXIT != STATS_EXIT
+#error "UVM_STATS_* must match the STATS_* indices in stats.h"
+#endif
 
 /****************************************************************************
  * structure definitions and static variables
  ***************************************************************************/
+struct uvm_request {/*{{{*/
+	int busy;
+	int done;
+	/* where the reply message is copied */
+	void *rep;
+	pthread_cond_t cond;
+};/*}}}*/
+/* what the MMU last set up for a page */
+struct uvm_pte {/*{{{*/
+	int prot;
+	/* offset in =pmem_fn= of the frame mapped, -1 if none */
+	off_t offset;
+	/* set while a SEGV for the page is in flight */
+	int faulting;
+};/*}}}*/
+struct uvm_capture {/*{{{*/
+	int fd;
+	/* number of pages tracked */
+	int npages;
+	/* protection installed, per page; it is lower than the one the MMU
+	 * set while an access is being sampled */
+	uint8_t *cur;
+	int32_t last;
+	uint64_t tick;
+	uint64_t last_tick;
+	unsigned period;
+	int stop;
+	pthread_t thread;
+	pthread_cond_t cond;
+	size_t len;
+	unsigned char buf[UVM_CAPTURE_BUF];
+};/*}}}*/
 struct uvm_data {/*{{{*/
 	int running;
 	int npages;
+	size_t pagesz;
 	int sock;
+	/* framing negotiated at CREATE; =reader= is only used by
+	 * =uvm_thread= once it starts */
+	int version;
+	struct frame_reader reader;
 	pthread_t thread;
 	pthread_mutex_t mutex;
+	/* signaled when a request slot becomes free */
 	pthread_cond_t cond;
 	char *pmem_fn;
 	int pmem_fd;
-	intptr_t result;
+	/* requests in flight, indexed by =reqid= */
+	struct uvm_request requests[UVM_MAX_REQUESTS];
+	/* shadow page table covering UVM_BASEADDR to UVM_MAXADDR, kept up to
+	 * date by the REMAP and CHPROT handlers */
+	struct uvm_pte *ptes;
+	int nptes;
+	/* signaled when a SEGV request completes */
+	pthread_cond_t fault_cond;
+	/* NULL unless UVM_CAPTURE is set */
+	struct uvm_capture *capture;
 };/*}}}*/
 
 static struct uvm_data *uvm = NULL;
@@ -50,17 +139,46 @@ static void * uvm_thread(void *data);
 static void uvm_exit(int status, void *arg);
 static void uvm_segv_action(int signum, siginfo_t *si, void *context);
 
-/* Protocol message handlers assume assume `uvm->mutex` is locked. */
-static void uvm_proto_extend_rep(void);
-static void uvm_proto_syslog_rep(void);
-static void uvm_proto_segv_rep(void);
-static void uvm_proto_remap_rep(void);
-static void uvm_proto_chprot_rep(void);
+/* Request slot functions assume `uvm->mutex` is locked. */
+static uint32_t uvm_request_start(void *rep);
+static void uvm_request_wait(uint32_t reqid);
+static void uvm_request_done(uint32_t reqid, const void *rep, size_t len);
+static void uvm_reserve(void *vaddr, size_t npages);
+
+/* Shadow page table functions assume `uvm->mutex` is locked. */
+static void uvm_pte_set(void *vaddr, size_t npages, int prot, off_t offset);
+static int uvm_pte_allows(intptr_t va, int write);
+static int uvm_fault_write(const void *context);
+
+/* Protocol message handlers assume assume `uvm->mutex` is locked.  Each
+ * gets a message of its type and its length. */
+static void uvm_proto_extend_rep(const void *msg, size_t len);
+static void uvm_proto_extendv_rep(const void *msg, size_t len);
+static void uvm_proto_syslog_rep(const void *msg, size_t len);
+static void uvm_proto_stats_rep(const void *msg, size_t len);
+static void uvm_proto_segv_rep(const void *msg, size_t len);
+static void uvm_proto_remap_rep(const void *msg, size_t len);
+static void uvm_proto_chprot_rep(const void *msg, size_t len);
+static void uvm_proto_copy(void *rep, size_t size, const void *msg,
+		size_t len);
+static size_t uvm_proto_msgsize(uint32_t type);
+static void uvm_send(const void *msg, size_t len);
+
+/* Capture functions assume `uvm->mutex` is locked, except for the
+ * sampling thread. */
+static void uvm_capture_init(void);
+static void uvm_capture_destroy(void);
+static void uvm_capture_event(int kind, int64_t value);
+static void uvm_capture_flush(void);
+static void uvm_capture_set(void *vaddr, size_t npages, int prot);
+static int uvm_capture_fault(intptr_t va);
+static void * uvm_capture_thread(void *data);
 
 /* Helper functions */
 static void uvm_connect_socket(int sock, const struct sockaddr_un * addr);
 
-#define NUM_CONNECTION_TRIES 3
+/* longest nap between connection attempts, in milliseconds */
+#define CONNECT_BACKOFF_MAX 64
 
 #define prexit() do { loge(LOG_FATAL, __FILE__, __LINE__); \
 			char buf[80]; sprintf(buf, "%s:%d: ", __FILE__, __LINE__); \
@@ -73,6 +191,8 @@ void uvm_create(void)/*{{{*/
 {
 	#ifdef UVMLOG
 	log_init(LOG_EXTRA, "uvm.log", 1, 1<<20);
+	const char *async = getenv("UVM_LOG_ASYNC");
+	if(async) log_async(LOG_ASYNC_FLUSHSIZE, atoi(async));
 	#endif
 	logd(LOG_DEBUG, "uvm_create starting\n");
 	assert(uvm == NULL);
@@ -80,6 +200,15 @@ void uvm_create(void)/*{{{*/
 	if(!uvm) prexit();
 	uvm->running = 1;
 	uvm->npages = 0;
+	uvm->pagesz = sysconf(_SC_PAGESIZE);
+	uvm->nptes = (UVM_MAXADDR - UVM_BASEADDR + 1) / uvm->pagesz;
+	uvm->ptes = malloc(uvm->nptes * sizeof(*uvm->ptes));
+	if(!uvm->ptes) prexit();
+	for(int i = 0; i < uvm->nptes; ++i) {
+		uvm->ptes[i].prot = PROT_NONE;
+		uvm->ptes[i].offset = -1;
+		uvm->ptes[i].faulting = 0;
+	}
 
 	logd(LOG_DEBUG, "  connecting unix socket [%s]\n", MMU_PROTO_UNIX_PATH);
 	uvm->sock = socket(AF_UNIX, SOCK_STREAM, 0);
@@ -91,18 +220,40 @@ void uvm_create(void)/*{{{*/
 	strncat(addr.sun_path, MMU_PROTO_UNIX_PATH, MMU_PROTO_PATH_MAX-1);
 
 	uvm_connect_socket(uvm->sock, &addr);
+	frame_reader_init(&uvm->reader, uvm->sock, uvm_proto_msgsize);
 
-	logd(LOG_DEBUG, "  sending CREATE_REQ [%d]\n", (int)getpid());
-	struct mmu_proto_create_req req;
-	req.type = MMU_PROTO_CREATE_REQ;
+	/* a CREATE_REQ is a CREATE2_REQ without the trailing =version= */
+	struct mmu_proto_create2_req req;
+	size_t size = sizeof(req);
+	req.type = MMU_PROTO_CREATE2_REQ;
 	req.pid = (uint32_t)getpid();
-	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req))
+	memset(req.token, '\0', MMU_PROTO_TOKEN_MAX);
+	const char *token = getenv("UVM_TOKEN");
+	if(token) strncat(req.token, token, MMU_PROTO_TOKEN_MAX-1);
+	const char *version = getenv("UVM_PROTO_VERSION");
+	req.version = version ? atoi(version) : MMU_PROTO_VERSION;
+	if(req.version <= MMU_PROTO_V1) {
+		req.type = MMU_PROTO_CREATE_REQ;
+		size = sizeof(struct mmu_proto_create_req);
+	}
+	logd(LOG_DEBUG, "  sending %s [%d]\n", req.type == MMU_PROTO_CREATE_REQ
+			? "CREATE_REQ" : "CREATE2_REQ", (int)getpid());
+	if(send(uvm->sock, &req, size, 0) != (ssize_t)size)
 		prexit();
 
 	logd(LOG_DEBUG, "  waiting CREATE_REP\n");
-	struct mmu_proto_create_rep rep;
-	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep)) prexit();
-	assert(rep.type == MMU_PROTO_CREATE_REP);
+	struct mmu_proto_create2_rep rep;
+	const void *msg;
+	size_t len;
+	if(frame_read(&uvm->reader, &msg, &len)) prexit();
+	uvm_proto_copy(&rep, sizeof(rep), msg, len);
+	assert(rep.type == MMU_PROTO_CREATE_REP
+			|| rep.type == MMU_PROTO_CREATE2_REP);
+	uvm->version = frame_negotiate(rep.version);
+	uvm->reader.version = uvm->version;
+	logd(LOG_DEBUG, "  using protocol version %d\n", uvm->version);
+	/* pages kept from an earlier process with the same token */
+	uvm->npages = rep.npages;
 
 	uvm->pmem_fn = strndup(rep.pmem_fn, MMU_PROTO_PATH_MAX);
 	logd(LOG_DEBUG, "  mapping pmem_fn [%s]\n", uvm->pmem_fn);
@@ -121,6 +272,12 @@ void uvm_create(void)/*{{{*/
 	logd(LOG_DEBUG, "  starting uvm_thread()\n");
 	pthread_mutex_init(&uvm->mutex, NULL);
 	pthread_cond_init(&uvm->cond, NULL);
+	pthread_cond_init(&uvm->fault_cond, NULL);
+	for(int i = 0; i < UVM_MAX_REQUESTS; ++i) {
+		uvm->requests[i].busy = 0;
+		pthread_cond_init(&uvm->requests[i].cond, NULL);
+	}
+	uvm_capture_init();
 	pthread_create(&uvm->thread, NULL, uvm_thread, NULL);
 
 	logd(LOG_DEBUG, "  setting up uvm_exit() on_exit()\n");
@@ -129,16 +286,57 @@ void uvm_create(void)/*{{{*/
 	logd(LOG_DEBUG, "uvm_create succeeded\n");
 }/*}}}*/
 
+void * uvm_pages(size_t *npages) {/*{{{*/
+	*npages = uvm->npages;
+	return (void *)UVM_BASEADDR;
+}/*}}}*/
+
 void * uvm_extend(void) {/*{{{*/
+	size_t count;
+	return uvm_extend_batch(1, &count);
+}/*}}}*/
+
+void * uvm_extend_batch(size_t npages, size_t *count) {/*{{{*/
 	pthread_mutex_lock(&uvm->mutex);
 	struct mmu_proto_extend_req req;
+	struct mmu_proto_extend_rep rep;
 	req.type = MMU_PROTO_EXTEND_REQ;
-	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req))
-		prexit();
-	pthread_cond_wait(&uvm->cond, &uvm->mutex);
-	if(uvm->result) uvm->npages++;
+	req.reqid = uvm_request_start(&rep);
+	req.npages = npages > UINT32_MAX ? UINT32_MAX : (uint32_t)npages;
+	uvm_send(&req, sizeof(req));
+	uvm_request_wait(req.reqid);
+	void *vaddr = (void *)(intptr_t)rep.vaddr;
+	*count = vaddr ? rep.npages : 0;
+	uvm_reserve(vaddr, *count);
 	pthread_mutex_unlock(&uvm->mutex);
-	return (void *)uvm->result;
+	if(!vaddr) errno = ENOSPC;
+	return vaddr;
+}/*}}}*/
+
+size_t uvm_extendv(struct uvm_extent *extents, int n) {/*{{{*/
+	assert(n >= 0 && n <= UVM_EXTENDV_MAX);
+	pthread_mutex_lock(&uvm->mutex);
+	struct mmu_proto_extendv_req req;
+	struct mmu_proto_extendv_rep rep;
+	req.type = MMU_PROTO_EXTENDV_REQ;
+	req.reqid = uvm_request_start(&rep);
+	req.count = (uint32_t)n;
+	for(int i = 0; i < n; ++i) {
+		size_t npages = extents[i].npages;
+		req.npages[i] = npages > UINT32_MAX ? UINT32_MAX : (uint32_t)npages;
+	}
+	uvm_send(&req, sizeof(req));
+	uvm_request_wait(req.reqid);
+	size_t total = 0;
+	for(int i = 0; i < n; ++i) {
+		extents[i].addr = (void *)(intptr_t)rep.vaddr[i];
+		extents[i].npages = extents[i].addr ? rep.npages[i] : 0;
+		uvm_reserve(extents[i].addr, extents[i].npages);
+		total += extents[i].npages;
+	}
+	pthread_mutex_unlock(&uvm->mutex);
+	if(!total) errno = ENOSPC;
+	return total;
 }/*}}}*/
 
 int uvm_syslog(void *addr, size_t len)/*{{{*/
@@ -147,13 +345,38 @@ int uvm_syslog(void *addr, size_t len)/*{{{*/
 	struct mmu_proto_syslog_req req;
 	req.type = MMU_PROTO_SYSLOG_REQ;
 	req.addr = (intptr_t)addr;
+	struct mmu_proto_syslog_rep rep;
 	req.len = len;
-	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req))
-		prexit();
-	pthread_cond_wait(&uvm->cond, &uvm->mutex);
-	if(uvm->result != 0) errno = EINVAL;
+	req.reqid = uvm_request_start(&rep);
+	uvm_send(&req, sizeof(req));
+	uvm_request_wait(req.reqid);
+	int result = (int32_t)rep.retcode;
 	pthread_mutex_unlock(&uvm->mutex);
-	return (int)uvm->result;
+	if(result == 0) return 0;
+	errno = -result;
+	return -1;
+}/*}}}*/
+
+int uvm_stats(struct uvm_stats *stats)/*{{{*/
+{
+	pthread_mutex_lock(&uvm->mutex);
+	struct mmu_proto_stats_req req;
+	req.type = MMU_PROTO_STATS_REQ;
+	struct mmu_proto_stats_rep rep;
+	req.reqid = uvm_request_start(&rep);
+	uvm_send(&req, sizeof(req));
+	uvm_request_wait(req.reqid);
+	pthread_mutex_unlock(&uvm->mutex);
+	for(int i = 0; i < UVM_STATS_COUNTERS; ++i)
+		stats->counters[i] = rep.counters[i];
+	for(int i = 0; i < UVM_STATS_HISTS; ++i) {
+		stats->hists[i].count = rep.count[i];
+		stats->hists[i].mean = rep.mean[i];
+		stats->hists[i].p50 = rep.p50[i];
+		stats->hists[i].p99 = rep.p99[i];
+		stats->hists[i].max = rep.max[i];
+	}
+	return 0;
 }/*}}}*/
 
 /****************************************************************************
@@ -168,32 +391,43 @@ void * uvm_thread(void *data) {/*{{{*/
 
 	while(uvm->running) {
 		logd(LOG_DEBUG, "uvm_thread waiting message\n");
-		uint32_t type;
-		ssize_t c = recv(uvm->sock, &type, sizeof(type), MSG_PEEK);
+		const void *msg;
+		size_t len;
+		int failed = frame_read(&uvm->reader, &msg, &len);
 		if(!uvm->running) break;
-		if(c != sizeof(type)) prexit();
+		if(failed) prexit();
+		uint32_t type;
+		memcpy(&type, msg, sizeof(type));
 		pthread_mutex_lock(&uvm->mutex);
 		switch(type) {
 			case MMU_PROTO_EXTEND_REP:
-				uvm_proto_extend_rep();
+				uvm_proto_extend_rep(msg, len);
+				break;
+			case MMU_PROTO_EXTENDV_REP:
+				uvm_proto_extendv_rep(msg, len);
 				break;
 			case MMU_PROTO_SYSLOG_REP:
-				uvm_proto_syslog_rep();
+				uvm_proto_syslog_rep(msg, len);
+				break;
+			case MMU_PROTO_STATS_REP:
+				uvm_proto_stats_rep(msg, len);
 				break;
 			case MMU_PROTO_SEGV_REP:
-				uvm_proto_segv_rep();
+				uvm_proto_segv_rep(msg, len);
 				break;
 			case MMU_PROTO_REMAP_REP:
-				uvm_proto_remap_rep();
+				uvm_proto_remap_rep(msg, len);
 				break;
 			case MMU_PROTO_CHPROT_REP:
-				uvm_proto_chprot_rep();
+				uvm_proto_chprot_rep(msg, len);
 				break;
 			case MMU_PROTO_EXIT_REP:
 				uvm->running = 0;
 				break;
 			default:
-				prexit();
+				/* only framed messages get here */
+				logd(LOG_DEBUG, "skipping message type %u\n",
+						(unsigned)type);
 				break;
 		}
 		pthread_mutex_unlock(&uvm->mutex);
@@ -208,15 +442,20 @@ void uvm_exit(int status, void *arg)/*{{{*/
 	struct mmu_proto_exit_req req;
 	req.type = MMU_PROTO_EXIT_REQ;
 	/* socket may have been closed by the MMU, ignore return value: */
-	send(uvm->sock, &req, sizeof(req), 0);
+	frame_send(uvm->sock, uvm->version, &req, sizeof(req));
 	pthread_mutex_unlock(&(uvm->mutex));
 	pthread_join(uvm->thread, NULL);
 	close(uvm->sock);
+	if(uvm->capture) uvm_capture_destroy();
 
 	pthread_mutex_destroy(&uvm->mutex);
 	pthread_cond_destroy(&uvm->cond);
+	pthread_cond_destroy(&uvm->fault_cond);
+	for(int i = 0; i < UVM_MAX_REQUESTS; ++i)
+		pthread_cond_destroy(&uvm->requests[i].cond);
 	free(uvm->pmem_fn);
 	close(uvm->pmem_fd);
+	free(uvm->ptes);
 	free(uvm);
 	uvm = NULL;
 	#ifdef UVMLOG
@@ -235,67 +474,189 @@ void uvm_segv_action(int signum, siginfo_t *si, void *context)/*{{{*/
 		fprintf(stderr, "(external) segmentation fault\n");
 		exit(EXIT_FAILURE);
 	}
-	size_t pagesz = sysconf(_SC_PAGESIZE);
-	if(va >= UVM_BASEADDR + (uvm->npages * pagesz)) {
+	if(va >= UVM_BASEADDR + (uvm->npages * uvm->pagesz)) {
 		logd(LOG_DEBUG, "access to unnallocated MMU address.\n");
 		fprintf(stderr, "(internal) segmentation fault.\n");
 		fprintf(stderr, "address %p not allocated.\n", (void *)va);
 		exit(EXIT_FAILURE);
 	}
+	if(uvm->capture && uvm_capture_fault(va)) {
+		pthread_mutex_unlock(&uvm->mutex);
+		return;
+	}
+	/* Threads touching a page concurrently fault together; only one
+	 * of them asks the MMU at a time, and the others retry the access
+	 * if the REMAP or CHPROT that served it gives them access too. */
+	struct uvm_pte *pte = &uvm->ptes[(va - UVM_BASEADDR) / uvm->pagesz];
+	int write = uvm_fault_write(context);
+	for(;;) {
+		if(uvm_pte_allows(va, write)) {
+			logd(LOG_DEBUG, "fault on %p already served\n", (void *)va);
+			pthread_mutex_unlock(&uvm->mutex);
+			return;
+		}
+		if(!pte->faulting) break;
+		pthread_cond_wait(&uvm->fault_cond, &uvm->mutex);
+	}
+	pte->faulting = 1;
 
 	struct mmu_proto_segv_req req;
+	struct mmu_proto_segv_rep rep;
 	req.type = MMU_PROTO_SEGV_REQ;
 	req.addr = (intptr_t)si->si_addr;
 	req.code = si->si_code;
-	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req)) prexit();
-
-	logd(LOG_DEBUG, "%s waiting service at condition variable\n", __func__);
-	pthread_cond_wait(&uvm->cond, &uvm->mutex);
+	req.reqid = uvm_request_start(&rep);
+	uvm_send(&req, sizeof(req));
+
+	logd(LOG_DEBUG, "%s waiting service of request %u\n", __func__,
+			(unsigned)req.reqid);
+	uvm_request_wait(req.reqid);
+	pte->faulting = 0;
+	pthread_cond_broadcast(&uvm->fault_cond);
+	if(rep.retcode != 0) {
+		logd(LOG_DEBUG, "pager could not service fault.\n");
+		fprintf(stderr, "(internal) out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
 	pthread_mutex_unlock(&uvm->mutex);
 	logd(LOG_DEBUG, "%s returning\n", __func__);
 }/*}}}*/
 
+/****************************************************************************
+ * request slots
+ ***************************************************************************/
+uint32_t uvm_request_start(void *rep)/*{{{*/
+{
+	for(;;) {
+		for(uint32_t i = 0; i < UVM_MAX_REQUESTS; ++i) {
+			if(uvm->requests[i].busy) continue;
+			uvm->requests[i].busy = 1;
+			uvm->requests[i].done = 0;
+			uvm->requests[i].rep = rep;
+			return i;
+		}
+		pthread_cond_wait(&uvm->cond, &uvm->mutex);
+	}
+}/*}}}*/
+
+void uvm_request_wait(uint32_t reqid)/*{{{*/
+{
+	struct uvm_request *r = &uvm->requests[reqid];
+	while(!r->done) pthread_cond_wait(&r->cond, &uvm->mutex);
+	r->busy = 0;
+	pthread_cond_signal(&uvm->cond);
+}/*}}}*/
+
+void uvm_request_done(uint32_t reqid, const void *rep, size_t len)/*{{{*/
+{
+	if(reqid >= UVM_MAX_REQUESTS || !uvm->requests[reqid].busy) {
+		logd(LOG_FATAL, "reply to unknown request %u\n", (unsigned)reqid);
+		prexit();
+	}
+	struct uvm_request *r = &uvm->requests[reqid];
+	memcpy(r->rep, rep, len);
+	r->done = 1;
+	pthread_cond_signal(&r->cond);
+}/*}}}*/
+
+void uvm_reserve(void *vaddr, size_t npages)/*{{{*/
+{
+	/* concurrent extends may complete out of order */
+	if(!vaddr) return;
+	int end = ((intptr_t)vaddr - UVM_BASEADDR) / uvm->pagesz + npages;
+	if(end <= uvm->npages) return;
+	if(uvm->capture) uvm_capture_event(CAPTURE_EXTEND, end - uvm->npages);
+	uvm->npages = end;
+}/*}}}*/
+
+/****************************************************************************
+ * shadow page table
+ ***************************************************************************/
+void uvm_pte_set(void *vaddr, size_t npages, int prot, off_t offset)/*{{{*/
+{
+	/* a negative =offset= keeps the frames mapped */
+	int page = ((intptr_t)vaddr - UVM_BASEADDR) / uvm->pagesz;
+	for(size_t i = 0; i < npages && page + i < uvm->nptes; ++i) {
+		uvm->ptes[page + i].prot = prot;
+		if(offset >= 0)
+			uvm->ptes[page + i].offset = offset + i * uvm->pagesz;
+	}
+	if(uvm->capture) uvm_capture_set(vaddr, npages, prot);
+}/*}}}*/
+
+int uvm_pte_allows(intptr_t va, int write)/*{{{*/
+{
+	/* =write= is -1 when the kind of access is unknown, in which case
+	 * only read-write pages are known to allow it */
+	int prot = uvm->ptes[(va - UVM_BASEADDR) / uvm->pagesz].prot;
+	if(write) return (prot & PROT_WRITE) != 0;
+	return (prot & PROT_READ) != 0;
+}/*}}}*/
+
+int uvm_fault_write(const void *context)/*{{{*/
+{
+	#ifdef REG_ERR
+	/* bit 1 of the x86 page fault error code is set on writes */
+	const ucontext_t *uc = context;
+	return (uc->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+	#else
+	return -1;
+	#endif
+}/*}}}*/
+
 /****************************************************************************
  * protocol message handlers
  ***************************************************************************/
-void uvm_proto_extend_rep(void)/*{{{*/
+void uvm_proto_extend_rep(const void *msg, size_t len)/*{{{*/
 {
 	logd(LOG_DEBUG, "processing EXTEND_REP\n");
 	struct mmu_proto_extend_rep rep;
-	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		prexit();
+	uvm_proto_copy(&rep, sizeof(rep), msg, len);
 	assert(rep.type == MMU_PROTO_EXTEND_REP);
-	uvm->result = (intptr_t)rep.vaddr;
-	pthread_cond_signal(&uvm->cond);
+	uvm_request_done(rep.reqid, &rep, sizeof(rep));
 }/*}}}*/
 
-void uvm_proto_syslog_rep(void)/*{{{*/
+void uvm_proto_extendv_rep(const void *msg, size_t len)/*{{{*/
+{
+	logd(LOG_DEBUG, "processing EXTENDV_REP\n");
+	struct mmu_proto_extendv_rep rep;
+	uvm_proto_copy(&rep, sizeof(rep), msg, len);
+	assert(rep.type == MMU_PROTO_EXTENDV_REP);
+	uvm_request_done(rep.reqid, &rep, sizeof(rep));
+}/*}}}*/
+
+void uvm_proto_syslog_rep(const void *msg, size_t len)/*{{{*/
 {
 	logd(LOG_DEBUG, "processing SYSLOG_REP\n");
 	struct mmu_proto_syslog_rep rep;
-	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		prexit();
+	uvm_proto_copy(&rep, sizeof(rep), msg, len);
 	assert(rep.type == MMU_PROTO_SYSLOG_REP);
-	uvm->result = (intptr_t)rep.retcode;
-	pthread_cond_signal(&uvm->cond);
+	uvm_request_done(rep.reqid, &rep, sizeof(rep));
 }/*}}}*/
 
-void uvm_proto_segv_rep(void)/*{{{*/
+void uvm_proto_stats_rep(const void *msg, size_t len)/*{{{*/
+{
+	logd(LOG_DEBUG, "processing STATS_REP\n");
+	struct mmu_proto_stats_rep rep;
+	uvm_proto_copy(&rep, sizeof(rep), msg, len);
+	assert(rep.type == MMU_PROTO_STATS_REP);
+	uvm_request_done(rep.reqid, &rep, sizeof(rep));
+}/*}}}*/
+
+void uvm_proto_segv_rep(const void *msg, size_t len)/*{{{*/
 {
 	logd(LOG_DEBUG, "processing SEGV_REP\n");
 	struct mmu_proto_segv_rep rep;
-	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		prexit();
+	uvm_proto_copy(&rep, sizeof(rep), msg, len);
 	assert(rep.type == MMU_PROTO_SEGV_REP);
-	pthread_cond_signal(&uvm->cond);
+	uvm_request_done(rep.reqid, &rep, sizeof(rep));
 }/*}}}*/
 
-void uvm_proto_remap_rep(void)/*{{{*/
+void uvm_proto_remap_rep(const void *msg, size_t len)/*{{{*/
 {
 	logd(LOG_DEBUG, "processing REMAP_REP\n");
 	struct mmu_proto_remap_rep rep;
-	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		prexit();
+	uvm_proto_copy(&rep, sizeof(rep), msg, len);
 	assert(rep.type == MMU_PROTO_REMAP_REP);
 	assert(rep.prot != PROT_NONE);
 
@@ -303,70 +664,255 @@ void uvm_proto_remap_rep(void)/*{{{*/
 	void *addr = (void *)(intptr_t)rep.vaddr;
 	int prot = (int)rep.prot;
 	off_t off = (off_t)rep.offset;
-	size_t pagesz = sysconf(_SC_PAGESIZE);
-	logd(LOG_DEBUG, "remapping %p at offset %llu prot %d\n", rep.vaddr,
-			(unsigned long long)rep.offset, prot);
-	if(((uintptr_t)rep.vaddr % (uintptr_t)pagesz) != 0) {
+	size_t size = uvm->pagesz * rep.npages;
+	logd(LOG_DEBUG, "remapping %p at offset %llu prot %d npages %u\n",
+			addr, (unsigned long long)rep.offset, prot,
+			(unsigned)rep.npages);
+	if(((uintptr_t)rep.vaddr % (uintptr_t)uvm->pagesz) != 0) {
 		logd(LOG_FATAL, "error: unaligned remap of vaddr %p\n", addr);
 		prexit();
 	}
-	munmap(addr, pagesz);
-	void *r = mmap(addr, pagesz, prot, MAP_SHARED, uvm->pmem_fd, off);
+	/* MAP_FIXED atomically replaces whatever is mapped in the range
+	 * and sets the final protection, so no munmap or mprotect is
+	 * needed */
+	void *r = mmap(addr, size, prot, MAP_SHARED | MAP_FIXED, uvm->pmem_fd,
+			off);
 	if(r != addr)
 		prexit();
-	logd(LOG_DEBUG, "mprotect %p prot %d\n", rep.vaddr, prot);
-	if(mprotect(addr, pagesz, prot) == -1)
-		prexit();
+	uvm_pte_set(addr, rep.npages, prot, off);
 
 	struct mmu_proto_remap_req req;
 	req.type = MMU_PROTO_REMAP_REQ;
-	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req)) prexit();
+	uvm_send(&req, sizeof(req));
 }/*}}}*/
 
-void uvm_proto_chprot_rep(void)/*{{{*/
+void uvm_proto_chprot_rep(const void *msg, size_t len)/*{{{*/
 {
 	logd(LOG_DEBUG, "processing CHPROT_REP\n");
 	struct mmu_proto_chprot_rep rep;
-	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		prexit();
+	uvm_proto_copy(&rep, sizeof(rep), msg, len);
 	assert(rep.type == MMU_PROTO_CHPROT_REP);
 
 	assert(rep.vaddr < UINTPTR_MAX);
 	void *addr = (void *)(uintptr_t)rep.vaddr;
 	int prot = (int)rep.prot;
-	size_t pagesz = sysconf(_SC_PAGESIZE);
 	logd(LOG_DEBUG, "mprotect %p prot %d\n", addr, prot);
-	if(mprotect(addr, pagesz, prot) == -1)
+	if(mprotect(addr, uvm->pagesz, prot) == -1)
 		prexit();
+	uvm_pte_set(addr, 1, prot, -1);
 	/* if(prot == PROT_NONE) {
 		logd(LOG_DEBUG, "unmaping %p\n", rep.vaddr);
-		if(munmap(addr, pagesz) == -1)
+		if(munmap(addr, uvm->pagesz) == -1)
 			prexit();
 	} */
 
 	struct mmu_proto_chprot_req req;
 	req.type = MMU_PROTO_CHPROT_REQ;
-	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req)) prexit();
+	uvm_send(&req, sizeof(req));
+}/*}}}*/
+
+void uvm_proto_copy(void *rep, size_t size, const void *msg, size_t len)/*{{{*/
+{
+	/* framed messages may be shorter or longer than the ones we know */
+	if(len > size) len = size;
+	memcpy(rep, msg, len);
+	memset((char *)rep + len, 0, size - len);
+}/*}}}*/
+
+size_t uvm_proto_msgsize(uint32_t type)/*{{{*/
+{
+	switch(type) {
+	case MMU_PROTO_CREATE_REP:
+		return sizeof(struct mmu_proto_create_rep);
+	case MMU_PROTO_CREATE2_REP:
+		return sizeof(struct mmu_proto_create2_rep);
+	case MMU_PROTO_EXTEND_REP:
+		return sizeof(struct mmu_proto_extend_rep);
+	case MMU_PROTO_EXTENDV_REP:
+		return sizeof(struct mmu_proto_extendv_rep);
+	case MMU_PROTO_SYSLOG_REP:
+		return sizeof(struct mmu_proto_syslog_rep);
+	case MMU_PROTO_STATS_REP:
+		return sizeof(struct mmu_proto_stats_rep);
+	case MMU_PROTO_SEGV_REP:
+		return sizeof(struct mmu_proto_segv_rep);
+	case MMU_PROTO_REMAP_REP:
+		return sizeof(struct mmu_proto_remap_rep);
+	case MMU_PROTO_CHPROT_REP:
+		return sizeof(struct mmu_proto_chprot_rep);
+	case MMU_PROTO_EXIT_REP:
+		return sizeof(struct mmu_proto_exit_rep);
+	}
+	return 0;
+}/*}}}*/
+
+void uvm_send(const void *msg, size_t len)/*{{{*/
+{
+	if(frame_send(uvm->sock, uvm->version, msg, len) != (ssize_t)len)
+		prexit();
+}/*}}}*/
+
+/****************************************************************************
+ * access capture
+ ***************************************************************************/
+void uvm_capture_init(void)/*{{{*/
+{
+	uvm->capture = NULL;
+	const char *prefix = getenv("UVM_CAPTURE");
+	if(!prefix) return;
+	struct uvm_capture *cap = calloc(1, sizeof(*cap));
+	if(!cap) prexit();
+	cap->npages = uvm->nptes;
+	cap->cur = calloc(cap->npages, sizeof(*cap->cur));
+	if(!cap->cur) prexit();
+	const char *period = getenv("UVM_CAPTURE_PERIOD");
+	cap->period = period && atoi(period) > 0 ? atoi(period)
+			: UVM_CAPTURE_PERIOD;
+
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s.%d", prefix, (int)getpid());
+	logd(LOG_DEBUG, "  capturing accesses to [%s]\n", path);
+	cap->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(cap->fd == -1) prexit();
+	struct capture_header hdr;
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	memcpy(hdr.magic, CAPTURE_MAGIC, sizeof(hdr.magic));
+	hdr.pid = (uint32_t)getpid();
+	hdr.period = cap->period;
+	hdr.start = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	if(write(cap->fd, &hdr, sizeof(hdr)) != sizeof(hdr)) prexit();
+
+	pthread_cond_init(&cap->cond, NULL);
+	uvm->capture = cap;
+	/* pages kept for the process's token */
+	if(uvm->npages) uvm_capture_event(CAPTURE_EXTEND, uvm->npages);
+	pthread_create(&cap->thread, NULL, uvm_capture_thread, NULL);
+}/*}}}*/
+
+void uvm_capture_destroy(void)/*{{{*/
+{
+	struct uvm_capture *cap = uvm->capture;
+	pthread_mutex_lock(&uvm->mutex);
+	cap->stop = 1;
+	pthread_cond_signal(&cap->cond);
+	pthread_mutex_unlock(&uvm->mutex);
+	pthread_join(cap->thread, NULL);
+	uvm_capture_flush();
+	close(cap->fd);
+	pthread_cond_destroy(&cap->cond);
+	free(cap->cur);
+	free(cap);
+	uvm->capture = NULL;
+}/*}}}*/
+
+void uvm_capture_event(int kind, int64_t value)/*{{{*/
+{
+	struct uvm_capture *cap = uvm->capture;
+	if(cap->len + 2 * CAPTURE_EVENT_MAX > UVM_CAPTURE_BUF)
+		uvm_capture_flush();
+	if(cap->tick != cap->last_tick) {
+		cap->len += capture_encode(cap->buf + cap->len, CAPTURE_TICK,
+				cap->tick - cap->last_tick, &cap->last);
+		cap->last_tick = cap->tick;
+	}
+	cap->len += capture_encode(cap->buf + cap->len, kind, value, &cap->last);
+}/*}}}*/
+
+void uvm_capture_flush(void)/*{{{*/
+{
+	/* write is safe in the SEGV handler */
+	struct uvm_capture *cap = uvm->capture;
+	size_t off = 0;
+	while(off < cap->len) {
+		ssize_t c = write(cap->fd, cap->buf + off, cap->len - off);
+		if(c == -1 && errno == EINTR) continue;
+		if(c == -1) prexit();
+		off += c;
+	}
+	cap->len = 0;
+}/*}}}*/
+
+void uvm_capture_set(void *vaddr, size_t npages, int prot)/*{{{*/
+{
+	struct uvm_capture *cap = uvm->capture;
+	int page = ((intptr_t)vaddr - UVM_BASEADDR) / uvm->pagesz;
+	for(size_t i = 0; i < npages && page + i < cap->npages; ++i)
+		cap->cur[page + i] = prot;
+}/*}}}*/
+
+int uvm_capture_fault(intptr_t va)/*{{{*/
+{
+	/* Records the access and returns 1 if the page was only protected
+	 * to sample it; the MMU serves the other faults. */
+	struct uvm_capture *cap = uvm->capture;
+	int page = (va - UVM_BASEADDR) / uvm->pagesz;
+	int cur = cap->cur[page];
+	/* faults on readable pages are writes */
+	uvm_capture_event(cur == PROT_NONE ? CAPTURE_READ : CAPTURE_WRITE, page);
+	if(cur == uvm->ptes[page].prot) return 0;
+	/* write access is given back on a second fault, so writes are
+	 * told apart from reads */
+	int prot = cur == PROT_NONE ? PROT_READ : uvm->ptes[page].prot;
+	void *addr = (void *)(UVM_BASEADDR + page * uvm->pagesz);
+	if(mprotect(addr, uvm->pagesz, prot) == -1) prexit();
+	cap->cur[page] = prot;
+	return 1;
+}/*}}}*/
+
+void * uvm_capture_thread(void *data)/*{{{*/
+{
+	struct uvm_capture *cap = uvm->capture;
+	pthread_mutex_lock(&uvm->mutex);
+	while(!cap->stop) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += (long)(cap->period % 1000) * 1000000;
+		deadline.tv_sec += cap->period / 1000 + deadline.tv_nsec / 1000000000;
+		deadline.tv_nsec %= 1000000000;
+		int rc = 0;
+		while(!cap->stop && rc != ETIMEDOUT)
+			rc = pthread_cond_timedwait(&cap->cond, &uvm->mutex, &deadline);
+		if(cap->stop) break;
+		cap->tick++;
+		/* protect accessible pages again, a run of pages at a time, so
+		 * their next access is recorded */
+		int limit = uvm->npages < cap->npages ? uvm->npages : cap->npages;
+		for(int page = 0; page < limit;) {
+			if(cap->cur[page] == PROT_NONE) {
+				page++;
+				continue;
+			}
+			int start = page;
+			while(page < limit && cap->cur[page] != PROT_NONE)
+				cap->cur[page++] = PROT_NONE;
+			void *addr = (void *)(UVM_BASEADDR + start * uvm->pagesz);
+			if(mprotect(addr, (page - start) * uvm->pagesz, PROT_NONE) == -1)
+				prexit();
+		}
+	}
+	pthread_mutex_unlock(&uvm->mutex);
+	return NULL;
 }/*}}}*/
 
 /****************************************************************************
  * external functions
  ***************************************************************************/
 void uvm_connect_socket(int sock, const struct sockaddr_un * addr) {
-	int try = 0;
-	do {
-		sleep(try);
-		if(connect(uvm->sock, (struct sockaddr *)addr, sizeof(*addr)) == 0) {
-			return;
-		}
-		loge(LOG_ERROR, __FILE__, __LINE__);
-		logd(LOG_FATAL, "%s connection attempt %d/%d failed\n",
-				MMU_PROTO_UNIX_PATH,
-				try + 1,
-				NUM_CONNECTION_TRIES);
-		try += 1;
-	} while(try < NUM_CONNECTION_TRIES);
-	if(connect(uvm->sock, (struct sockaddr *)addr, sizeof(*addr)) == -1) {
-		prexit();
+	long waited = 0;
+	long nap = 1;
+	while(connect(sock, (struct sockaddr *)addr, sizeof(*addr)) == -1) {
+		/* the MMU may not have created or started listening on the
+		 * socket yet */
+		if(errno != ENOENT && errno != ECONNREFUSED && errno != EAGAIN)
+			prexit();
+		if(waited >= MMU_PROTO_CONNECT_MS)
+			prexit();
+		logd(LOG_DEBUG, "%s connection failed, retrying in %ld ms\n",
+				MMU_PROTO_UNIX_PATH, nap);
+		struct timespec ts = {0, nap * 1000000L};
+		nanosleep(&ts, NULL);
+		waited += nap;
+		nap = nap * 2 > CONNECT_BACKOFF_MAX ? CONNECT_BACKOFF_MAX : nap * 2;
 	}
 }
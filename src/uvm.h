@@ -5,14 +5,36 @@
 #ifndef __UVM_HEADER__
 #define __UVM_HEADER__
 
+#include <stdint.h>
 #include <stdlib.h>
 
 /* `uvm_create` should be called when a program starts to bind it to
  * the memory management infrastructure.  This function sets up
  * a UNIX socket to communicate with the memory management
- * infrastructure and installs a signal handler for SIGSEGV. */
+ * infrastructure and installs a signal handler for SIGSEGV.  If the
+ * UVM_TOKEN environment variable is set, the process identifies
+ * itself with its value, and may start with the pages an earlier
+ * process with the same token left behind (see `uvm_pages`).  When
+ * built with UVMLOG and UVM_LOG_ASYNC is set, debug logging is
+ * asynchronous and flushed every UVM_LOG_ASYNC milliseconds.
+ * UVM_PROTO_VERSION caps the protocol version asked of the MMU (see
+ * mmuproto.h); the latest is used by default, and with 1 the
+ * process talks to the MMU as clients that predate versions do.
+ *
+ * When UVM_CAPTURE is set, the process records its page accesses in
+ * the file named UVM_CAPTURE followed by a dot and its pid, in the
+ * format described in capture.h, for replay with `pagersim`.  Every
+ * UVM_CAPTURE_PERIOD milliseconds (10 by default) the process's
+ * pages are protected again, so the first read and the first write
+ * to each page in each period are recorded. */
 void uvm_create(void);
 
+/* `uvm_pages` returns the address of the first page of the calling
+ * process and stores in `npages` how many consecutive pages it has.
+ * Right after `uvm_create` these are the pages kept for the
+ * process's token, with their previous contents. */
+void * uvm_pages(size_t *npages);
+
 /* `uvm_extend` allocates a new page for the calling process and
  * returns the address where the page was mapped.  This is analogous
  * to the `sbrk` system call.  Memory allocated with `uvm_extend` is
@@ -22,11 +44,70 @@ void uvm_create(void);
  * system page size is given by `sysconf(_SC_PAGESIZE)`. */
 void * uvm_extend(void);
 
+/* `uvm_extend_batch` allocates up to `npages` consecutive pages in
+ * a single request to the memory management infrastructure and
+ * returns the address of the first page.  The number of pages
+ * allocated is stored in `count`; fewer than `npages` pages are
+ * allocated if swap runs out.  If no page can be allocated,
+ * `uvm_extend_batch` returns NULL, stores 0 in `count`, and sets
+ * `errno` to ENOSPC. */
+void * uvm_extend_batch(size_t npages, size_t *count);
+
+/* `uvm_extendv` makes the `n` allocations described in `extents`,
+ * up to `UVM_EXTENDV_MAX`, in a single request.  For each extent,
+ * `npages` gives the number of consecutive pages requested; on
+ * return, `addr` and `npages` hold the address of the first page
+ * and the number of pages allocated, as in `uvm_extend_batch`.
+ * Extents are allocated in order from the end of the address
+ * space.  Returns the total number of pages allocated; if it is 0,
+ * sets `errno` to ENOSPC. */
+#define UVM_EXTENDV_MAX 16
+struct uvm_extent {
+	void *addr;
+	size_t npages;
+};
+size_t uvm_extendv(struct uvm_extent *extents, int n);
+
 /* `uvm_syslog` requests the memory infrastructure to write the
  * string at `addr` with `len` bytes.  Memory at `addr` must be
  * managed by the memory infrastructure (i.e., allocated with
  * `uvm_extend`).  Returns 0 on success; on failure, returns -1 and
- * sets `errno` to EINVAL. */
+ * sets `errno` to EINVAL, or to ENOMEM if the memory infrastructure
+ * ran out of memory and swap while reading the string. */
 int uvm_syslog(void *addr, size_t len);
 
+/* `uvm_stats` fills `stats` with the memory infrastructure's
+ * statistics, accumulated over all processes since it started.
+ * `counters` is indexed by the `UVM_STATS_` counter names below.
+ * `hists` describes the time the infrastructure spent serving each
+ * type of request, in nanoseconds, indexed by the `UVM_STATS_`
+ * request names below.  Returns 0. */
+#define UVM_STATS_FAULT_ZERO 0   /* first-touch faults */
+#define UVM_STATS_FAULT_PROT 1   /* faults on resident pages */
+#define UVM_STATS_FAULT_SWAPIN 2 /* faults served from disk */
+#define UVM_STATS_EVICT 3        /* evictions */
+#define UVM_STATS_WRITEBACK 4    /* pages written to disk */
+#define UVM_STATS_DISK_READ 5    /* pages read from disk */
+#define UVM_STATS_SWEEP 6        /* frames visited by the clock */
+#define UVM_STATS_LOCK_WAIT 7    /* nanoseconds waiting for locks */
+#define UVM_STATS_COUNTERS 8
+
+#define UVM_STATS_CREATE 0
+#define UVM_STATS_EXTEND 1
+#define UVM_STATS_SYSLOG 2
+#define UVM_STATS_SEGV 3
+#define UVM_STATS_EXIT 4
+#define UVM_STATS_HISTS 5
+struct uvm_stats {
+	uint64_t counters[UVM_STATS_COUNTERS];
+	struct {
+		uint64_t count;
+		uint64_t mean;
+		uint64_t p50;
+		uint64_t p99;
+		uint64_t max;
+	} hists[UVM_STATS_HISTS];
+};
+int uvm_stats(struct uvm_stats *stats);
+
 #endif